@@ -1,41 +1,140 @@
 #pragma once
 
 #include <assert.h>
+#include <float.h>
+#include <locale.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
+#include <mutex>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#ifdef __APPLE__
+#include <xlocale.h>
+#endif
 
 namespace gason2 {
-template <typename T>
-class vector {
+// Allocator policies for vector: reallocate(p, old_size, size) resizes a
+// block keeping its first min(old_size, size) bytes, deallocate(p, size)
+// releases it. Sizes are the capacities in bytes the vector asked for.
+struct heap_allocator {
+    void *reallocate(void *p, size_t, size_t size) { return realloc(p, size); }
+    void deallocate(void *p, size_t) { free(p); }
+};
+
+#ifdef __linux__
+// Blocks of at least threshold bytes are mapped directly, so growing them
+// moves page table entries with mremap instead of copying, and they are
+// advised to use transparent huge pages; smaller blocks live on the heap.
+template <size_t threshold = 2 * 1024 * 1024>
+struct mapped_allocator {
+    static constexpr size_t huge_page_size = 2 * 1024 * 1024;
+
+    static size_t mapping_size(size_t size) {
+        return (size + huge_page_size - 1) & ~(huge_page_size - 1);
+    }
+
+    static void *advise(void *p, size_t size) {
+        if (p == MAP_FAILED)
+            return nullptr;
+#ifdef MADV_HUGEPAGE
+        madvise(p, mapping_size(size), MADV_HUGEPAGE);
+#endif
+        return p;
+    }
+
+    void *reallocate(void *p, size_t old_size, size_t size) {
+        if (old_size < threshold && size < threshold)
+            return realloc(p, size);
+        if (old_size >= threshold && size >= threshold)
+            return advise(mremap(p, mapping_size(old_size), mapping_size(size), MREMAP_MAYMOVE), size);
+
+        void *q = size >= threshold ? advise(mmap(nullptr, mapping_size(size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0), size) : malloc(size);
+        if (!q)
+            return nullptr;
+        if (p) {
+            memcpy(q, p, old_size < size ? old_size : size);
+            deallocate(p, old_size);
+        }
+        return q;
+    }
+
+    void deallocate(void *p, size_t size) {
+        if (size >= threshold)
+            munmap(p, mapping_size(size));
+        else
+            free(p);
+    }
+};
+#else
+template <size_t threshold = 2 * 1024 * 1024>
+struct mapped_allocator : heap_allocator {};
+#endif
+
+// The run-time counterpart of the allocator policies, for memory chosen
+// when the program runs: a jemalloc arena, a per-request pool, shared memory.
+struct memory_resource {
+    virtual ~memory_resource() = default;
+    virtual void *reallocate(void *p, size_t old_size, size_t size) = 0;
+    virtual void deallocate(void *p, size_t size) = 0;
+};
+
+class resource_allocator {
+    memory_resource *_resource;
+
+public:
+    resource_allocator(memory_resource &resource) : _resource(&resource) {}
+
+    void *reallocate(void *p, size_t old_size, size_t size) { return _resource->reallocate(p, old_size, size); }
+    void deallocate(void *p, size_t size) { _resource->deallocate(p, size); }
+    memory_resource *resource() const { return _resource; }
+};
+
+template <typename T, typename Allocator = heap_allocator>
+class vector : Allocator {
     T *_data = nullptr;
     size_t _size = 0;
     size_t _capacity = 0;
 
 public:
     vector() = default;
+    explicit vector(const Allocator &allocator) : Allocator(allocator) {}
 
-    vector(const vector &x) {
+    vector(const vector &x) : Allocator(x) {
         *this = x;
     }
 
-    vector(vector &&x) : _data(x._data), _size(x._size), _capacity(x._capacity) {
+    vector(vector &&x) : Allocator(static_cast<Allocator &&>(x)), _data(x._data), _size(x._size), _capacity(x._capacity) {
         x._data = nullptr;
         x._size = x._capacity = 0;
     }
 
     ~vector() {
-        free(_data);
+        this->deallocate(_data, sizeof(T) * _capacity);
     }
 
     vector &operator=(const vector &x) {
-        resize(x._size);
-        memcpy(_data, x._data, sizeof(T) * x._size);
+        if (resize(x._size))
+            memcpy(_data, x._data, sizeof(T) * x._size);
         return *this;
     }
 
     vector &operator=(vector &&x) {
-        free(_data);
+        this->deallocate(_data, sizeof(T) * _capacity);
+        Allocator::operator=(static_cast<Allocator &&>(x));
 
         _data = x._data;
         _size = x._size;
@@ -47,31 +146,42 @@ public:
         return *this;
     }
 
-    void set_capacity(size_t n) {
+    // growing returns false and leaves the vector as it was when the
+    // allocator runs out of memory
+    bool set_capacity(size_t n) {
+        T *data = static_cast<T *>(this->reallocate(_data, sizeof(T) * _capacity, sizeof(T) * n));
+        if (!data && n)
+            return false;
         if (n < _size)
             _size = n;
-        _data = static_cast<T *>(realloc(_data, sizeof(T) * n));
+        _data = data;
         _capacity = n;
+        return true;
     }
 
-    void reserve(size_t n) {
-        if (_capacity < n)
-            set_capacity(_capacity * 2 < n ? n : _capacity * 2);
+    bool reserve(size_t n) {
+        return _capacity >= n || set_capacity(_capacity * 2 < n ? n : _capacity * 2);
     }
 
-    void resize(size_t n) {
-        reserve(n);
+    bool resize(size_t n) {
+        if (!reserve(n))
+            return false;
         _size = n;
+        return true;
     }
 
-    void append(const T *x, size_t n) {
-        resize(_size + n);
+    bool append(const T *x, size_t n) {
+        if (!resize(_size + n))
+            return false;
         memcpy(_data + _size - n, x, sizeof(T) * n);
+        return true;
     }
 
-    void push_back(const T &x) {
-        reserve(_size + 1);
+    bool push_back(const T &x) {
+        if (!reserve(_size + 1))
+            return false;
         _data[_size++] = x;
+        return true;
     }
 
     void pop_back() {
@@ -114,19 +224,341 @@ public:
     size_t size() const { return _size; }
     size_t capacity() const { return _capacity; }
     bool empty() const { return _size == 0; }
+    const Allocator &get_allocator() const { return *this; }
+};
+
+template <typename Allocator = heap_allocator>
+class basic_arena : Allocator {
+    struct chunk {
+        chunk *next;
+        size_t size;
+    };
+
+    static constexpr size_t chunk_size = 64 * 1024;
+
+    chunk *_chunks = nullptr;
+    char *_first = nullptr;
+    char *_last = nullptr;
+    size_t _used = 0;
+
+    char *add_chunk(size_t size) {
+        chunk *c = static_cast<chunk *>(this->reallocate(nullptr, 0, sizeof(chunk) + size));
+        if (!c)
+            return nullptr;
+        c->next = _chunks;
+        c->size = sizeof(chunk) + size;
+        _chunks = c;
+        return reinterpret_cast<char *>(c + 1);
+    }
+
+public:
+    basic_arena() = default;
+    explicit basic_arena(const Allocator &allocator) : Allocator(allocator) {}
+    basic_arena(const basic_arena &) = delete;
+    basic_arena &operator=(const basic_arena &) = delete;
+
+    ~basic_arena() {
+        while (_chunks) {
+            chunk *next = _chunks->next;
+            this->deallocate(_chunks, _chunks->size);
+            _chunks = next;
+        }
+    }
+
+    basic_arena(basic_arena &&x) : Allocator(x), _chunks(x._chunks), _first(x._first), _last(x._last), _used(x._used) {
+        x._chunks = nullptr;
+        x._first = x._last = nullptr;
+        x._used = 0;
+    }
+
+    basic_arena &operator=(basic_arena &&x) {
+        basic_arena temp(static_cast<basic_arena &&>(x));
+        chunk *chunks = _chunks;
+        _chunks = temp._chunks;
+        temp._chunks = chunks;
+        Allocator allocator = *this;
+        Allocator::operator=(temp);
+        static_cast<Allocator &>(temp) = allocator;
+        _first = temp._first;
+        _last = temp._last;
+        _used = temp._used;
+        return *this;
+    }
+
+    void *allocate(size_t n) {
+        const size_t align = alignof(double);
+        if (n > chunk_size / 4) {
+            _used += n;
+            return add_chunk(n);
+        }
+        _first = reinterpret_cast<char *>((reinterpret_cast<uintptr_t>(_first) + align - 1) & ~(align - 1));
+        if (!reserve(0, n))
+            return nullptr;
+        void *p = _first;
+        _first += (n + align - 1) & ~(align - 1);
+        _used += n;
+        return p;
+    }
+
+    // unaligned bump allocation: write into [begin(), end()), then commit
+    // the used part; reserve keeps the first `used` bytes when it has to move
+    char *reserve(size_t used, size_t n) {
+        // allocate() may have aligned _first past _last
+        if (_first > _last || static_cast<size_t>(_last - _first) < n) {
+            const size_t align = alignof(double);
+            size_t size = n < chunk_size ? chunk_size : (n + align - 1) & ~(align - 1);
+            char *first = add_chunk(size);
+            if (!first)
+                return nullptr;
+            if (used)
+                memcpy(first, _first, used);
+            _first = first;
+            _last = _first + size;
+        }
+        return _first;
+    }
+
+    void commit(char *p) {
+        assert(p >= _first && p <= _last);
+        _used += p - _first;
+        _first = p;
+    }
+
+    char *begin() { return _first; }
+    char *end() { return _last; }
+
+    // bytes handed out, and bytes held in chunks
+    size_t used() const { return _used; }
+    size_t capacity() const {
+        size_t n = 0;
+        for (chunk *c = _chunks; c; c = c->next)
+            n += c->size - sizeof(chunk);
+        return n;
+    }
+};
+
+using arena = basic_arena<>;
+
+// A monotonic arena that several documents can allocate from at once.
+// Freeing is a no-op except for the most recent allocation, which may also
+// grow in place; reset() recycles every block in O(1) without returning
+// them, and invalidates all documents that used the arena.
+class monotonic_arena {
+    struct block {
+        block *next;
+        size_t size;
+    };
+
+    static constexpr size_t align = alignof(double);
+
+    block *_blocks = nullptr;
+    block *_current = nullptr;
+    char *_first = nullptr;
+    char *_last = nullptr;
+    char *_last_allocation = nullptr;
+    size_t _block_size;
+    bool _fixed = false;
+    monotonic_arena *_next_free = nullptr;
+
+    friend class arena_pool;
+
+    void use(block *b) {
+        _current = b;
+        _first = reinterpret_cast<char *>(b + 1);
+        _last = _first + b->size;
+    }
+
+    bool next_block(size_t n) {
+        while (_current && _current->next) {
+            use(_current->next);
+            if (static_cast<size_t>(_last - _first) >= n)
+                return true;
+        }
+        if (_fixed)
+            return false;
+        while (_block_size < n)
+            _block_size *= 2;
+        block *b = static_cast<block *>(malloc(sizeof(block) + _block_size));
+        if (!b)
+            return false;
+        b->next = nullptr;
+        b->size = _block_size;
+        _block_size *= 2;
+        (_current ? _current->next : _blocks) = b;
+        use(b);
+        return true;
+    }
+
+public:
+    explicit monotonic_arena(size_t initial_size = 64 * 1024) : _block_size(initial_size < 64 ? 64 : initial_size) {
+        next_block(0);
+    }
+
+    // a hard budget: allocates only from the caller's buffer and never
+    // calls malloc, so a parse that needs more fails with out_of_memory
+    monotonic_arena(void *buffer, size_t size) : _block_size(0), _fixed(true) {
+        uintptr_t first = (reinterpret_cast<uintptr_t>(buffer) + align - 1) & ~(align - 1);
+        if (size >= first - reinterpret_cast<uintptr_t>(buffer) + sizeof(block)) {
+            _blocks = reinterpret_cast<block *>(first);
+            _blocks->next = nullptr;
+            _blocks->size = size - (first - reinterpret_cast<uintptr_t>(buffer)) - sizeof(block);
+            use(_blocks);
+        }
+    }
+
+    monotonic_arena(const monotonic_arena &) = delete;
+    monotonic_arena &operator=(const monotonic_arena &) = delete;
+
+    ~monotonic_arena() {
+        if (_fixed)
+            return;
+        while (_blocks) {
+            block *next = _blocks->next;
+            free(_blocks);
+            _blocks = next;
+        }
+    }
+
+    void *allocate(size_t n) {
+        n = (n + align - 1) & ~(align - 1);
+        if (static_cast<size_t>(_last - _first) < n && !next_block(n))
+            return nullptr;
+        _last_allocation = _first;
+        _first += n;
+        return _last_allocation;
+    }
+
+    void *reallocate(void *p, size_t old_size, size_t size) {
+        if (p && p == _last_allocation && static_cast<size_t>(_last - _last_allocation) >= size) {
+            _first = _last_allocation + ((size + align - 1) & ~(align - 1));
+            return p;
+        }
+        void *q = allocate(size);
+        if (q && p)
+            memcpy(q, p, old_size < size ? old_size : size);
+        return q;
+    }
+
+    void deallocate(void *p, size_t) {
+        if (p && p == _last_allocation) {
+            _first = _last_allocation;
+            _last_allocation = nullptr;
+        }
+    }
+
+    void reset() {
+        if (_blocks)
+            use(_blocks);
+        _last_allocation = nullptr;
+    }
+
+    // bytes held in blocks, used or not
+    size_t capacity() const {
+        size_t n = 0;
+        for (block *b = _blocks; b; b = b->next)
+            n += b->size;
+        return n;
+    }
+};
+
+// allocator policy that draws from a monotonic_arena
+class monotonic_allocator {
+    monotonic_arena *_arena;
+
+public:
+    monotonic_allocator(monotonic_arena &arena) : _arena(&arena) {}
+
+    void *reallocate(void *p, size_t old_size, size_t size) { return _arena->reallocate(p, old_size, size); }
+    void deallocate(void *p, size_t size) { _arena->deallocate(p, size); }
+};
+
+// Per-thread free lists of monotonic arenas that keep their blocks between
+// leases, so a worker in steady state parses without calling malloc.
+class arena_pool {
+    struct free_list {
+        monotonic_arena *head = nullptr;
+
+        ~free_list() {
+            while (head) {
+                monotonic_arena *next = head->_next_free;
+                delete head;
+                head = next;
+            }
+        }
+    };
+
+    static free_list &local() {
+        static thread_local free_list list;
+        return list;
+    }
+
+public:
+    // hands an arena back to the free list of the thread that drops it
+    class lease {
+        monotonic_arena *_arena;
+
+    public:
+        explicit lease(monotonic_arena *arena) : _arena(arena) {}
+        lease(const lease &) = delete;
+        lease &operator=(const lease &) = delete;
+        lease(lease &&x) : _arena(x._arena) { x._arena = nullptr; }
+
+        ~lease() {
+            if (_arena) {
+                _arena->reset();
+                free_list &list = local();
+                _arena->_next_free = list.head;
+                list.head = _arena;
+            }
+        }
+
+        monotonic_arena &operator*() const { return *_arena; }
+        monotonic_arena *operator->() const { return _arena; }
+    };
+
+    static lease acquire(size_t initial_size = 64 * 1024) {
+        free_list &list = local();
+        if (monotonic_arena *arena = list.head) {
+            list.head = arena->_next_free;
+            arena->_next_free = nullptr;
+            return lease(arena);
+        }
+        return lease(new monotonic_arena(initial_size));
+    }
+};
+
+class string_view {
+    const char *_data;
+    size_t _size;
+
+public:
+    string_view(const char *data = "") : _data(data), _size(strlen(data)) {}
+    string_view(const char *data, size_t size) : _data(data), _size(size) {}
+
+    const char *begin() const { return _data; }
+    const char *end() const { return _data + _size; }
+
+    const char *data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    char operator[](size_t i) const {
+        assert(i < size());
+        return _data[i];
+    }
 };
 
 enum class type : unsigned int {
-    number = 0xFFF80000,
+    number = 0xFFF8,
     null,
     boolean,
-    string,
     array,
     object,
+    string,
 };
 
 enum class error : unsigned int {
-    expecting_string = 0xFFF90000,
+    expecting_string = 1,
     expecting_value,
     invalid_literal_name,
     invalid_number,
@@ -136,26 +568,75 @@ enum class error : unsigned int {
     missing_colon,
     missing_comma_or_bracket,
     unexpected_character,
+    out_of_memory,
 };
 
+// Everything up to the quiet NaN 0xFFF8000000000000 is a number, otherwise
+// the top 16 bits are a tag and the low 48 bits a payload: storage offset,
+// container size, string length or error code.
 union var_t {
     char string[sizeof(double)];
     double number;
-    struct {
-        unsigned int payload;
-        union {
-            enum type type;
-            enum error error;
-        };
-    };
+    unsigned long long bits;
+
+    static constexpr unsigned long long payload_mask = 0x0000FFFFFFFFFFFFull;
+    static constexpr unsigned long long error_tag = 0xFFF8000000000000ull;
+    static constexpr unsigned long long string_tag = 0xFFFD000000000000ull;
+    static constexpr unsigned long long inline_tag = 0xFFFE000000000000ull;
+    static constexpr unsigned long long external_tag = 0xFFFF000000000000ull;
+    static constexpr size_t inline_capacity = 5;
 
     constexpr var_t(double x) : number(x) {}
-    constexpr var_t(enum type t, size_t x = 0) : payload(x), type(t) {}
-    constexpr var_t(enum error e) : error(e) {}
+    constexpr var_t(enum type t, size_t x = 0) : bits(static_cast<unsigned long long>(t) << 48 | x) {}
+    constexpr var_t(enum error e) : bits(error_tag | static_cast<unsigned long long>(e)) {}
+    // string whose bytes live outside of document storage, preceded by an
+    // unaligned {type::string, length} header, e.g. in a key_pool or arena
+    explicit var_t(const char *external) : bits(external_tag | reinterpret_cast<uintptr_t>(external)) {
+        assert(reinterpret_cast<uintptr_t>(external) <= payload_mask);
+    }
+
+    // short string kept in the low 6 bytes, terminator included
+    var_t(const char *s, size_t n) : bits(inline_tag) {
+        assert(n <= inline_capacity);
+        memcpy(string, s, n);
+    }
 
-    constexpr bool is_error() const { return type > type::object; }
+    // headers of strings that hold nothing JSON output must escape carry
+    // the external tag, others type::string; both read as strings
+    static constexpr unsigned long long verbatim_tag = external_tag;
+    static var_t string_header(size_t length, bool verbatim) {
+        var_t x{type::string, length};
+        if (verbatim)
+            x.bits |= verbatim_tag;
+        return x;
+    }
+
+    // segmented documents keep containers of more than segment_slots slots
+    // in blocks of that many, each followed by a link to the next block,
+    // which reads as an error since no element can be one
+    static constexpr size_t segment_slots = 2040;
+    static var_t link(const var_t *next) {
+        var_t x = type::null;
+        x.bits = error_tag | reinterpret_cast<uintptr_t>(next);
+        return x;
+    }
+    const var_t *linked() const { return reinterpret_cast<const var_t *>(bits & payload_mask); }
+
+    constexpr size_t payload() const { return static_cast<size_t>(bits & payload_mask); }
+    constexpr enum type type() const { return static_cast<enum type>(bits >> 48); }
+    constexpr enum error error() const { return static_cast<enum error>(payload()); }
+
+    constexpr bool is_number() const { return bits <= error_tag; }
+    constexpr bool is_error() const { return bits > error_tag && (bits >> 48) == (error_tag >> 48); }
+    constexpr bool is_string() const { return bits >= string_tag; }
+    constexpr bool is_unboxed_string() const { return bits >= inline_tag; }
+    constexpr bool is_inline() const { return bits >= inline_tag && bits < external_tag; }
+    constexpr bool is_external() const { return bits >= external_tag; }
+    const char *external() const { return reinterpret_cast<const char *>(bits & payload_mask); }
 };
 
+class lookup_key;
+
 class value {
 protected:
     var_t _data;
@@ -165,20 +646,77 @@ public:
     value(var_t data = type::null, const var_t *storage = nullptr) : _data(data), _storage(storage) {}
     value(const var_t *pointer, const var_t *storage) : value(*pointer, storage) {}
 
-    bool is_number() const { return _data.type <= type::number; }
-    bool is_null() const { return _data.type == type::null; }
-    bool is_bool() const { return _data.type == type::boolean; }
-    bool is_string() const { return _data.type == type::string; }
-    bool is_array() const { return _data.type == type::array; }
-    bool is_object() const { return _data.type == type::object; }
-
-    enum type type() const { return is_number() ? type::number : _data.type; }
+    bool is_number() const { return _data.is_number(); }
+    bool is_null() const { return _data.type() == type::null; }
+    bool is_bool() const { return _data.type() == type::boolean; }
+    bool is_string() const { return _data.is_string(); }
+    bool is_array() const { return _data.type() == type::array; }
+    bool is_object() const { return _data.type() == type::object; }
+
+    enum type type() const {
+        if (is_number())
+            return type::number;
+        if (is_string())
+            return type::string;
+        return _data.is_error() ? static_cast<enum type>(_data.error()) : _data.type();
+    }
 
     double to_number(double defval = 0.0) const { return is_number() ? _data.number : defval; }
     float to_float(float defval = 0.0f) const { return is_number() ? (float)_data.number : defval; }
     int to_int(int defval = 0) const { return is_number() ? (int)_data.number : defval; }
-    bool to_bool(bool defval = false) const { return is_bool() ? _data.payload != 0 : defval; }
-    const char *to_string(const char *defval = "") const { return is_string() ? _storage[_data.payload].string : defval; }
+    bool to_bool(bool defval = false) const { return is_bool() ? _data.payload() != 0 : defval; }
+    // short strings are boxed in the value itself, so the pointer lives as long as this value
+    const char *to_string(const char *defval = "") const { return is_string() ? characters() : defval; }
+    string_view to_string_view(string_view defval = {}) const { return is_string() ? string_view{to_string(), string_length()} : defval; }
+
+    size_t string_length() const {
+        if (!is_string())
+            return 0;
+        if (_data.is_inline())
+            return strlen(_data.string);
+        var_t header = type::null;
+        memcpy(&header, characters() - sizeof(var_t), sizeof(var_t));
+        return header.payload();
+    }
+
+    // true when the parser found that the string holds no byte JSON output
+    // has to escape; false when it does or nobody recorded it
+    bool is_verbatim() const {
+        if (!is_string() || _data.is_inline())
+            return false;
+        var_t header = type::null;
+        memcpy(&header, characters() - sizeof(var_t), sizeof(var_t));
+        return header.bits >= var_t::verbatim_tag;
+    }
+
+private:
+    const char *characters() const { return _data.is_inline() ? _data.string : _data.is_external() ? _data.external() : slot(_data.payload())->string; }
+
+protected:
+    // offsets are relative to storage; segmented documents have no storage
+    // base and use absolute slot addresses instead
+    const var_t *slot(size_t offset) const {
+        return reinterpret_cast<const var_t *>(reinterpret_cast<uintptr_t>(_storage) + offset * sizeof(var_t));
+    }
+
+    // whether a container of n slots is split into blocks, whose table is
+    // in the slot before its header
+    bool segmented(size_t n) const { return !_storage && n > var_t::segment_slots; }
+
+    // slot i of the container whose elements start at offset
+    const var_t *at(size_t offset, size_t i) const {
+        if (!segmented(slot(offset - 1)->payload()))
+            return slot(offset + i);
+        auto table = reinterpret_cast<const var_t *const *>(slot(offset - 2)->bits);
+        return table[i / var_t::segment_slots] + i % var_t::segment_slots;
+    }
+
+    // one past the last of the n slots of that container
+    const var_t *end(size_t offset, size_t n) const {
+        return segmented(n) ? at(offset, n - 1) + 1 : slot(offset) + n;
+    }
+
+public:
 
     class member {
         const var_t *_pointer, *_storage;
@@ -201,6 +739,8 @@ public:
         iterator(const var_t *pointer = nullptr, const var_t *storage = nullptr) : _pointer(pointer), _storage(storage) {}
         iterator &operator++() {
             _pointer += N;
+            if (!_storage && _pointer->is_error())
+                _pointer = _pointer->linked();
             return *this;
         }
         iterator operator++(int) {
@@ -224,25 +764,34 @@ public:
     };
 
     iterator_range<iterator<1, value>> elements() const {
-        auto pointer = _storage + _data.payload;
-        return {{pointer, _storage}, {pointer + (is_array() ? pointer[-1].payload : 0), _storage}};
+        auto pointer = slot(_data.payload());
+        return {{pointer, _storage}, {is_array() ? end(_data.payload(), pointer[-1].payload()) : pointer, _storage}};
     }
 
     iterator_range<iterator<2, member>> members() const {
-        auto pointer = _storage + _data.payload;
-        return {{pointer, _storage}, {pointer + (is_object() ? pointer[-1].payload : 0), _storage}};
+        auto pointer = slot(_data.payload());
+        return {{pointer, _storage}, {is_object() ? end(_data.payload(), pointer[-1].payload()) : pointer, _storage}};
     }
 
     size_t size() const {
         if (is_array())
-            return _storage[_data.payload - 1].payload;
+            return slot(_data.payload() - 1)->payload();
         else if (is_object())
-            return _storage[_data.payload - 1].payload / 2;
+            return slot(_data.payload() - 1)->payload() / 2;
         return 0;
     }
 
+    // the size() elements of an array of numbers only, which are doubles as
+    // they stand, marked by a type::number header; nullptr for other values
+    // and for arrays a segmented document split into blocks
+    const double *as_doubles() const {
+        if (!is_array() || slot(_data.payload() - 1)->type() != type::number || segmented(size()))
+            return nullptr;
+        return &slot(_data.payload())->number;
+    }
+
     value operator[](size_t index) const {
-        return index < size() ? value{_storage + _data.payload + index, _storage} : value{};
+        return index < size() ? value{at(_data.payload(), index), _storage} : value{};
     }
 
     value operator[](int index) const {
@@ -250,11 +799,154 @@ public:
     }
 
     value operator[](const char *name) const {
+        return operator[](string_view{name});
+    }
+
+    value operator[](string_view name) const {
         for (auto i : members())
-            if (!strcmp(name, i.name().to_string()))
+            if (i.name().string_length() == name.size() && !memcmp(name.data(), i.name().to_string(), name.size()))
                 return i.value();
         return {};
     }
+
+    // pooled and short names (see key_pool::find) match member names by
+    // identity; names kept elsewhere by their bytes
+    value operator[](const value &name) const {
+        if (!name._data.is_unboxed_string())
+            return name.is_string() ? operator[](name.to_string_view()) : value{};
+        for (auto i : members()) {
+            auto key = i.name();
+            if (key._data.bits == name._data.bits)
+                return i.value();
+            if (!(key._data.is_inline() && name._data.is_inline()) && key.string_length() == name.string_length() && !memcmp(key.to_string(), name.to_string(), key.string_length()))
+                return i.value();
+        }
+        return {};
+    }
+
+    value operator[](const lookup_key &name) const;
+};
+
+// What key_pool::find returns: the pooled or short name, or for a name the
+// pool does not hold, a null value that keeps the characters it was asked
+// for, so lookups still find members whose names stayed out of the pool.
+// It refers to those characters and must not outlive them.
+class lookup_key : public value {
+    string_view _name;
+
+public:
+    explicit lookup_key(string_view name, value pooled = {}) : value(pooled), _name(name) {}
+
+    string_view name() const { return _name; }
+};
+
+inline value value::operator[](const lookup_key &name) const {
+    return name.is_null() ? operator[](name.name()) : operator[](static_cast<const value &>(name));
+}
+
+// Member names shared between documents. Lookups are lock-free, inserts lock
+// one of the stripes; names are never removed, so the pool must outlive every
+// document parsed with it.
+class key_pool {
+    struct node {
+        const node *next;
+        size_t hash;
+        var_t header;
+
+        const char *characters() const { return reinterpret_cast<const char *>(this + 1); }
+    };
+
+    struct stripe {
+        std::mutex lock;
+        arena memory;
+    };
+
+    static constexpr size_t stripe_count = 16;
+
+    std::atomic<const node *> *_buckets;
+    size_t _mask;
+    size_t _limit;
+    std::atomic<size_t> _size{0};
+    stripe _stripes[stripe_count];
+
+    static size_t hash(const char *s, size_t n) {
+        unsigned long long h = 0xCBF29CE484222325ull;
+        while (n--)
+            h = (h ^ static_cast<unsigned char>(*s++)) * 0x100000001B3ull;
+        return static_cast<size_t>(h);
+    }
+
+    static const node *find(const node *p, size_t h, const char *s, size_t n) {
+        for (; p; p = p->next)
+            if (p->hash == h && p->header.payload() == n && !memcmp(p->characters(), s, n))
+                return p;
+        return nullptr;
+    }
+
+public:
+    // bucket_count is rounded up to a power of two, limit caps the number of pooled names
+    explicit key_pool(size_t bucket_count = 4096, size_t limit = 1 << 20) : _limit(limit) {
+        size_t n = stripe_count;
+        while (n < bucket_count)
+            n *= 2;
+        _buckets = new std::atomic<const node *>[n];
+        for (size_t i = 0; i < n; ++i)
+            _buckets[i].store(nullptr, std::memory_order_relaxed);
+        _mask = n - 1;
+    }
+
+    key_pool(const key_pool &) = delete;
+    key_pool &operator=(const key_pool &) = delete;
+
+    ~key_pool() {
+        delete[] _buckets;
+    }
+
+    size_t size() const { return _size.load(std::memory_order_relaxed); }
+
+    // returns pooled characters preceded by a string header, or nullptr when the pool is full
+    const char *intern(const char *s, size_t n) {
+        size_t h = hash(s, n);
+        auto &bucket = _buckets[h & _mask];
+        if (auto p = find(bucket.load(std::memory_order_acquire), h, s, n))
+            return p->characters();
+
+        // a full pool turns names away without taking a lock
+        if (size() >= _limit)
+            return nullptr;
+        auto &st = _stripes[h & (stripe_count - 1)];
+        std::lock_guard<std::mutex> guard(st.lock);
+        auto head = bucket.load(std::memory_order_relaxed);
+        if (auto p = find(head, h, s, n))
+            return p->characters();
+        if (size() >= _limit)
+            return nullptr;
+
+        auto p = static_cast<node *>(st.memory.allocate(sizeof(node) + n + 1));
+        if (!p)
+            return nullptr;
+        p->next = head;
+        p->hash = h;
+        bool verbatim = true;
+        for (size_t i = 0; i < n; ++i)
+            verbatim &= static_cast<unsigned char>(s[i]) >= ' ' && s[i] != '"' && s[i] != '\\';
+        p->header = var_t::string_header(n, verbatim);
+        memcpy(reinterpret_cast<char *>(p + 1), s, n);
+        reinterpret_cast<char *>(p + 1)[n] = '\0';
+        bucket.store(p, std::memory_order_release);
+        _size.fetch_add(1, std::memory_order_relaxed);
+        return p->characters();
+    }
+
+    lookup_key find(const char *s) const {
+        size_t n = strlen(s);
+        if (n <= var_t::inline_capacity)
+            return lookup_key({s, n}, var_t{s, n});
+        size_t h = hash(s, n);
+        if (auto p = find(_buckets[h & _mask].load(std::memory_order_acquire), h, s, n))
+            return lookup_key({s, n}, var_t{p->characters()});
+        return lookup_key({s, n});
+    }
 };
 
 struct stream {
@@ -270,72 +962,117 @@ struct stream {
     }
 };
 
-struct parser {
+template <typename Allocator = heap_allocator>
+struct basic_parser {
     static inline bool is_digit(int c) { return c >= '0' && c <= '9'; }
 
+    // strtod of [first, last) as the "C" locale reads it, whatever the
+    // program set LC_NUMERIC to
+    static double strtod_c(const char *first, const char *last) {
+#if defined(_MSC_VER)
+        static const _locale_t c = _create_locale(LC_ALL, "C");
+        (void)last;
+        return _strtod_l(first, nullptr, c);
+#elif defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__)
+        static const locale_t c = newlocale(LC_ALL_MASK, "C", (locale_t)0);
+        (void)last;
+        return strtod_l(first, nullptr, c);
+#else
+        // a copy with the decimal point strtod expects now
+        const char *point = localeconv()->decimal_point;
+        size_t n = last - first, m = strlen(point);
+        char buf[64];
+        char *copy = n + m < sizeof(buf) ? buf : static_cast<char *>(malloc(n + m + 1));
+        if (!copy)
+            return strtod(first, nullptr);
+        char *q = copy;
+        for (const char *p = first; p != last; ++p) {
+            if (*p == '.') {
+                memcpy(q, point, m);
+                q += m;
+            } else {
+                *q++ = *p;
+            }
+        }
+        *q = '\0';
+        double x = strtod(copy, nullptr);
+        if (copy != buf)
+            free(copy);
+        return x;
+#endif
+    }
+
+    // Clinger's fast path when the digits and the power of ten are both
+    // exact doubles, an 80-bit long double product that is checked to round
+    // once where that type exists, and strtod in the "C" locale for the rest
     static var_t parse_number(stream &s) {
-        unsigned long long integer = 0;
-        double significand = 0;
-        int fraction = 0;
+        const char *first = s.c_str();
+        unsigned long long integer = s.getch() - '0';
         int exponent = 0;
-
-        integer = s.getch() - '0';
-        if (integer)
-            while (is_digit(s.peek()) && integer < 0x1999999999999999ull)
-                integer = (integer * 10) + (s.getch() - '0');
-
-        if (integer >= 0x1999999999999999ull) {
-            significand = static_cast<double>(integer);
-            while (is_digit(s.peek()))
-                significand = (significand * 10) + (s.getch() - '0');
+        bool exact = true;
+
+        if (integer) {
+            while (is_digit(s.peek())) {
+                if (integer < 0x1999999999999999ull) {
+                    integer = (integer * 10) + (s.getch() - '0');
+                } else {
+                    exact &= s.getch() == '0';
+                    ++exponent;
+                }
+            }
         }
 
         if (s.peek() == '.') {
             s.getch();
-
-            while (is_digit(s.peek()) && integer < 0x1FFFFFFFFFFFFFull) {
-                integer = (integer * 10) + (s.getch() - '0');
-                --fraction;
+            while (is_digit(s.peek())) {
+                if (integer < 0x1999999999999999ull) {
+                    integer = (integer * 10) + (s.getch() - '0');
+                    --exponent;
+                } else {
+                    exact &= s.getch() == '0';
+                }
             }
-
-            while (is_digit(s.peek()))
-                s.getch();
         }
 
-        if (integer < 0x1999999999999999ull)
-            significand = static_cast<double>(integer);
-
         if ((s.peek() | 0x20) == 'e') {
             s.getch();
-            if (s.peek() == '-') {
+            bool negative = s.peek() == '-';
+            if (negative || s.peek() == '+')
                 s.getch();
-                if (!is_digit(s.peek()))
-                    return error::invalid_number;
-                while (is_digit(s.peek()))
-                    exponent = (exponent * 10) - (s.getch() - '0');
-            } else {
-                if (s.peek() == '+')
-                    s.getch();
-                if (!is_digit(s.peek()))
-                    return error::invalid_number;
-                while (is_digit(s.peek()))
-                    exponent = (exponent * 10) + (s.getch() - '0');
+            if (!is_digit(s.peek()))
+                return error::invalid_number;
+            int e = 0;
+            while (is_digit(s.peek())) {
+                int d = s.getch() - '0';
+                if (e < 100000)
+                    e = (e * 10) + d;
             }
+            exponent += negative ? -e : e;
         }
 
-        static constexpr double exp10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22, 1e23, 1e24, 1e25, 1e26, 1e27, 1e28, 1e29, 1e30, 1e31, 1e32, 1e33, 1e34, 1e35, 1e36, 1e37, 1e38, 1e39, 1e40, 1e41, 1e42, 1e43, 1e44, 1e45, 1e46, 1e47, 1e48, 1e49, 1e50, 1e51, 1e52, 1e53, 1e54, 1e55, 1e56, 1e57, 1e58, 1e59, 1e60, 1e61, 1e62, 1e63, 1e64, 1e65, 1e66, 1e67, 1e68, 1e69, 1e70, 1e71, 1e72, 1e73, 1e74, 1e75, 1e76, 1e77, 1e78, 1e79, 1e80, 1e81, 1e82, 1e83, 1e84, 1e85, 1e86, 1e87, 1e88, 1e89, 1e90, 1e91, 1e92, 1e93, 1e94, 1e95, 1e96, 1e97, 1e98, 1e99, 1e100, 1e101, 1e102, 1e103, 1e104, 1e105, 1e106, 1e107, 1e108, 1e109, 1e110, 1e111, 1e112, 1e113, 1e114, 1e115, 1e116, 1e117, 1e118, 1e119, 1e120, 1e121, 1e122, 1e123, 1e124, 1e125, 1e126, 1e127, 1e128, 1e129, 1e130, 1e131, 1e132, 1e133, 1e134, 1e135, 1e136, 1e137, 1e138, 1e139, 1e140, 1e141, 1e142, 1e143, 1e144, 1e145, 1e146, 1e147, 1e148, 1e149, 1e150, 1e151, 1e152, 1e153, 1e154, 1e155, 1e156, 1e157, 1e158, 1e159, 1e160, 1e161, 1e162, 1e163, 1e164, 1e165, 1e166, 1e167, 1e168, 1e169, 1e170, 1e171, 1e172, 1e173, 1e174, 1e175, 1e176, 1e177, 1e178, 1e179, 1e180, 1e181, 1e182, 1e183, 1e184, 1e185, 1e186, 1e187, 1e188, 1e189, 1e190, 1e191, 1e192, 1e193, 1e194, 1e195, 1e196, 1e197, 1e198, 1e199, 1e200, 1e201, 1e202, 1e203, 1e204, 1e205, 1e206, 1e207, 1e208, 1e209, 1e210, 1e211, 1e212, 1e213, 1e214, 1e215, 1e216, 1e217, 1e218, 1e219, 1e220, 1e221, 1e222, 1e223, 1e224, 1e225, 1e226, 1e227, 1e228, 1e229, 1e230, 1e231, 1e232, 1e233, 1e234, 1e235, 1e236, 1e237, 1e238, 1e239, 1e240, 1e241, 1e242, 1e243, 1e244, 1e245, 1e246, 1e247, 1e248, 1e249, 1e250, 1e251, 1e252, 1e253, 1e254, 1e255, 1e256, 1e257, 1e258, 1e259, 1e260, 1e261, 1e262, 1e263, 1e264, 1e265, 1e266, 1e267, 1e268, 1e269, 1e270, 1e271, 1e272, 1e273, 1e274, 1e275, 1e276, 1e277, 1e278, 1e279, 1e280, 1e281, 1e282, 1e283, 1e284, 1e285, 1e286, 1e287, 1e288, 1e289, 1e290, 1e291, 1e292, 1e293, 1e294, 1e295, 1e296, 1e297, 1e298, 1e299, 1e300, 1e301, 1e302, 1e303, 1e304, 1e305, 1e306, 1e307, 1e308};
-        exponent += fraction;
-        if (exponent < 0) {
-            if (exponent < -308) {
-                significand /= exp10[308];
-                exponent += 308;
-            }
-            significand = exponent < -308 ? 0.0 : significand / exp10[-exponent];
-        } else {
-            significand *= exp10[exponent < 308 ? exponent : 308];
+        if (integer == 0)
+            return 0.0;
+
+        static constexpr double exp10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+        if (exact && integer <= (1ull << 53) && exponent >= -22 && exponent <= 22)
+            return exponent < 0 ? integer / exp10[-exponent] : integer * exp10[exponent];
+
+#if LDBL_MANT_DIG == 64
+        // 10^27 = 5^27 * 2^27 with 5^27 < 2^64 is the largest exact power
+        static constexpr long double exp10l[] = {1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L, 1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L, 1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L};
+        if (exact && exponent >= -27 && exponent <= 27) {
+            long double x = exponent < 0 ? integer / exp10l[-exponent] : integer * exp10l[exponent];
+            // the product is within half an ulp of 64 bits; rounding it to
+            // 53 bits is correct unless it lies next to a halfway point
+            unsigned long long mantissa;
+            memcpy(&mantissa, &x, sizeof(mantissa));
+            unsigned low = mantissa & 0x7FF;
+            if (low < 0x3FF || low > 0x401)
+                return static_cast<double>(x);
         }
+#endif
 
-        return significand;
+        return strtod_c(first, s.c_str());
     }
 
     static int parse_hex(stream &s) {
@@ -351,87 +1088,450 @@ struct parser {
         return cp;
     }
 
-    static var_t parse_string(stream &s, vector<var_t> &v) {
-        for (size_t length = 0, offset = v.size();;) {
-            v.resize(v.size() + 4);
+    // decodes into [first, last) up to the closing quote, returns type::string
+    // when the string is complete and type::null when it runs out of room
+    // escaped is set when the string decodes to a byte that output must
+    // escape again, which only an escape sequence can produce
+    static var_t decode_string(stream &s, char *&first, char *last, bool &escaped) {
+        while (first < last) {
+            int ch = s.getch();
+
+            if (ch < ' ')
+                return error::invalid_string_char;
+
+            if (ch == '"')
+                return type::string;
+
+            if (ch == '\\') {
+                switch (s.getch()) {
+                // clang-format off
+                case '\x22': ch = '"'; break;
+                case '\x2F': ch = '/'; break;
+                case '\x5C': ch = '\\'; break;
+                case '\x62': ch = '\b'; break;
+                case '\x66': ch = '\f'; break;
+                case '\x6E': ch = '\n'; break;
+                case '\x72': ch = '\r'; break;
+                case '\x74': ch = '\t'; break;
+                // clang-format on
+                case '\x75':
+                    if ((ch = parse_hex(s)) < 0)
+                        return error::invalid_string_escape;
 
-            char *first = (v.begin() + offset)->string + length;
-            char *last = v.end()->string - 5;
+                    if (ch >= 0xD800 && ch <= 0xDBFF) {
+                        if (s.getch() != '\\' || s.getch() != '\x75')
+                            return error::invalid_surrogate_pair;
+                        int low = parse_hex(s);
+                        if (low < 0xDC00 || low > 0xDFFF)
+                            return error::invalid_surrogate_pair;
+                        ch = 0x10000 + ((ch & 0x3FF) << 10) + (low & 0x3FF);
+                    }
+
+                    if (ch < 0x80) {
+                        escaped |= ch < ' ' || ch == '"' || ch == '\\';
+                        *first++ = (char)ch;
+                    } else if (ch < 0x800) {
+                        *first++ = 0xC0 | ((char)(ch >> 6));
+                        *first++ = 0x80 | (ch & 0x3F);
+                    } else if (ch < 0x10000) {
+                        *first++ = 0xE0 | ((char)(ch >> 12));
+                        *first++ = 0x80 | ((ch >> 6) & 0x3F);
+                        *first++ = 0x80 | (ch & 0x3F);
+                    } else {
+                        *first++ = 0xF0 | ((char)(ch >> 18));
+                        *first++ = 0x80 | ((ch >> 12) & 0x3F);
+                        *first++ = 0x80 | ((ch >> 6) & 0x3F);
+                        *first++ = 0x80 | (ch & 0x3F);
+                    }
+                    continue;
+                default:
+                    return error::invalid_string_escape;
+                }
+                escaped |= ch != '/';
+            }
 
-            while (first < last) {
-                int ch = s.getch();
+            *first++ = (char)ch;
+        }
+        return type::null;
+    }
+
+    static var_t parse_string(stream &s, vector<var_t, Allocator> &v) {
+        bool escaped = false;
+        for (size_t length = 0, offset = v.size() + 1;;) {
+            if (!v.resize(v.size() + 4))
+                return error::out_of_memory;
+
+            char *first = (v.begin() + offset)->string + length;
+            var_t x = decode_string(s, first, v.end()->string - 5, escaped);
+            length = first - (v.begin() + offset)->string;
 
-                if (ch < ' ')
-                    return error::invalid_string_char;
+            if (x.is_error())
+                return x;
 
-                if (ch == '"') {
-                    *first++ = '\0';
-                    length = first - (v.begin() + offset)->string;
-                    v.resize(offset + ((length + sizeof(var_t)) / sizeof(var_t)));
-                    return {type::string, offset};
+            if (x.type() == type::string) {
+                *first = '\0';
+                if (length <= var_t::inline_capacity && !memchr(v[offset].string, '\0', length)) {
+                    x = var_t{v[offset].string, length};
+                    v.resize(offset - 1);
+                    return x;
                 }
+                v.resize(offset + ((length + sizeof(var_t)) / sizeof(var_t)));
+                v[offset - 1] = var_t::string_header(length, !escaped);
+                return {type::string, offset};
+            }
+        }
+    }
 
-                if (ch == '\\') {
-                    switch (s.getch()) {
-                    // clang-format off
-                    case '\x22': ch = '"'; break;
-                    case '\x2F': ch = '/'; break;
-                    case '\x5C': ch = '\\'; break;
-                    case '\x62': ch = '\b'; break;
-                    case '\x66': ch = '\f'; break;
-                    case '\x6E': ch = '\n'; break;
-                    case '\x72': ch = '\r'; break;
-                    case '\x74': ch = '\t'; break;
-                    // clang-format on
-                    case '\x75':
-                        if ((ch = parse_hex(s)) < 0)
-                            return error::invalid_string_escape;
-
-                        if (ch >= 0xD800 && ch <= 0xDBFF) {
-                            if (s.getch() != '\\' || s.getch() != '\x75')
-                                return error::invalid_surrogate_pair;
-                            int low = parse_hex(s);
-                            if (low < 0xDC00 || low > 0xDFFF)
-                                return error::invalid_surrogate_pair;
-                            ch = 0x10000 + ((ch & 0x3FF) << 10) + (low & 0x3FF);
-                        }
-
-                        if (ch < 0x80) {
-                            *first++ = (char)ch;
-                        } else if (ch < 0x800) {
-                            *first++ = 0xC0 | ((char)(ch >> 6));
-                            *first++ = 0x80 | (ch & 0x3F);
-                        } else if (ch < 0x10000) {
-                            *first++ = 0xE0 | ((char)(ch >> 12));
-                            *first++ = 0x80 | ((ch >> 6) & 0x3F);
-                            *first++ = 0x80 | (ch & 0x3F);
-                        } else {
-                            *first++ = 0xF0 | ((char)(ch >> 18));
-                            *first++ = 0x80 | ((ch >> 12) & 0x3F);
-                            *first++ = 0x80 | ((ch >> 6) & 0x3F);
-                            *first++ = 0x80 | (ch & 0x3F);
-                        }
-                        continue;
-                    default:
-                        return error::invalid_string_escape;
+    static var_t parse_string(stream &s, basic_arena<Allocator> &a) {
+        const size_t header = sizeof(var_t);
+        if (!a.reserve(0, header + 32))
+            return error::out_of_memory;
+        bool escaped = false;
+        for (size_t length = 0;;) {
+            char *first = a.begin() + header + length;
+            var_t x = decode_string(s, first, a.end() - 5, escaped);
+            length = first - (a.begin() + header);
+
+            if (x.is_error())
+                return x;
+
+            if (x.type() == type::string) {
+                char *p = a.begin() + header;
+                if (length <= var_t::inline_capacity && !memchr(p, '\0', length))
+                    return var_t{p, length};
+                *first++ = '\0';
+                x = var_t::string_header(length, !escaped);
+                memcpy(a.begin(), &x, header);
+                a.commit(first);
+                return var_t{static_cast<const char *>(p)};
+            }
+
+            if (!a.reserve(header + length, 2 * (a.end() - a.begin())))
+                return error::out_of_memory;
+        }
+    }
+
+    vector<var_t, Allocator> _backlog;
+    vector<var_t, Allocator> _storage;
+    basic_arena<Allocator> _strings;
+    key_pool *_keys = nullptr;
+    bool _separate_strings = false;
+    bool _segmented = false;
+    bool _prescan = false;
+    vector<size_t, Allocator> _sizes;
+    size_t _next = 0;
+
+    basic_parser() = default;
+    explicit basic_parser(const Allocator &allocator) : _backlog(allocator), _storage(allocator), _strings(allocator), _sizes(allocator) {}
+
+    static int count_trailing_zeros(unsigned long long x) {
+#ifdef _MSC_VER
+        unsigned long i;
+        _BitScanForward64(&i, x);
+        return static_cast<int>(i);
+#else
+        return __builtin_ctzll(x);
+#endif
+    }
+
+    static size_t popcount(unsigned long long x) {
+#ifdef _MSC_VER
+        x = x - ((x >> 1) & 0x5555555555555555ull);
+        x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+        return static_cast<size_t>((((x + (x >> 4)) & 0x0F0F0F0F0F0F0F0Full) * 0x0101010101010101ull) >> 56);
+#else
+        return __builtin_popcountll(x);
+#endif
+    }
+
+    // bit masks of quotes, backslashes and brackets or commas in 64 bytes
+    static void classify(const char *p, unsigned long long &quote, unsigned long long &backslash, unsigned long long &structural) {
+        quote = backslash = structural = 0;
+#ifdef __SSE2__
+        for (int i = 0; i < 64; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+            __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+            __m128i brackets = _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('{')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('}')));
+            quote |= static_cast<unsigned long long>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('"')))) << i;
+            backslash |= static_cast<unsigned long long>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8('\\')))) << i;
+            structural |= static_cast<unsigned long long>(_mm_movemask_epi8(_mm_or_si128(brackets, _mm_cmpeq_epi8(x, _mm_set1_epi8(','))))) << i;
+        }
+#else
+        for (int i = 0; i < 64; ++i) {
+            int c = p[i];
+            if (c == '"')
+                quote |= 1ull << i;
+            else if (c == '\\')
+                backslash |= 1ull << i;
+            else if (c == ',' || (c | 0x20) == '{' || (c | 0x20) == '}')
+                structural |= 1ull << i;
+        }
+#endif
+    }
+
+    // counts elements (members for objects) of every container in document
+    // order and reserves storage for all of them, strings included, so that
+    // parse_array and parse_object write each slot once and never reallocate
+    bool prescan_sizes(const char *json) {
+        size_t length = strlen(json);
+        vector<size_t, Allocator> stack(_sizes.get_allocator());
+        size_t slots = 0, strings = 0, string_bytes = 0;
+        unsigned long long escape_carry = 0, string_carry = 0;
+
+        for (size_t offset = 0; offset < length; offset += 64) {
+            char tail[64];
+            const char *block = json + offset;
+            if (length - offset < 64) {
+                memset(tail, 0, sizeof(tail));
+                memcpy(tail, block, length - offset);
+                block = tail;
+            }
+
+            unsigned long long quote, backslash, structural;
+            classify(block, quote, backslash, structural);
+
+            unsigned long long escaped = escape_carry;
+            escape_carry = 0;
+            for (backslash &= ~escaped; backslash;) {
+                int i = count_trailing_zeros(backslash);
+                if (i == 63) {
+                    escape_carry = 1;
+                    break;
+                }
+                escaped |= 2ull << i;
+                backslash &= ~(3ull << i);
+            }
+            quote &= ~escaped;
+
+            // prefix xor: set from an opening quote up to its closing quote
+            unsigned long long in_string = quote;
+            for (int shift = 1; shift < 64; shift *= 2)
+                in_string ^= in_string << shift;
+            in_string ^= string_carry;
+            string_carry = in_string >> 63 ? ~0ull : 0;
+
+            strings += popcount(quote & in_string);
+            string_bytes += popcount(in_string);
+
+            for (structural &= ~in_string; structural; structural &= structural - 1) {
+                const char *p = json + offset + count_trailing_zeros(structural);
+                switch (*p) {
+                case '[':
+                case '{': {
+                    const char *q = p + 1;
+                    while (*q == '\x20' || *q == '\x9' || *q == '\xD' || *q == '\xA')
+                        ++q;
+                    if (!stack.push_back(_sizes.size()) || !_sizes.push_back(*q != ']' && *q != '}'))
+                        return false;
+                    break;
+                }
+                case ',':
+                    if (!stack.empty())
+                        ++_sizes[stack.back()];
+                    break;
+                default:
+                    if (!stack.empty()) {
+                        slots += 1 + (*p == '}' ? 2 : 1) * _sizes[stack.back()];
+                        stack.pop_back();
                     }
+                    break;
                 }
+            }
+        }
+
+        // parse_string decodes into four slots at a time, which may run past
+        // the end of the last string
+        if (!_separate_strings)
+            slots += 2 * strings + string_bytes / sizeof(var_t) + 4;
+        _prescan = true;
+        return _storage.reserve(slots);
+    }
 
-                *first++ = (char)ch;
+    var_t parse_array(stream &s) {
+        if (_next == _sizes.size())
+            return error::missing_comma_or_bracket;
+        size_t size = _sizes[_next++];
+        if (!_storage.push_back({type::array, size}) || !_storage.resize(_storage.size() + size))
+            return error::out_of_memory;
+        size_t offset = _storage.size() - size, i = offset;
+        bool numbers = true;
+        if (s.skipws() != ']') {
+        element:
+            var_t x = parse_value(s);
+            if (x.is_error())
+                return x;
+            if (i == offset + size)
+                return error::missing_comma_or_bracket;
+            _storage[i++] = x;
+            numbers &= x.is_number();
+
+            if (s.skipws() == ',') {
+                s.getch();
+                goto element;
             }
+        }
 
-            length = first - (v.begin() + offset)->string;
+        if (s.getch() != ']' || i != offset + size)
+            return error::missing_comma_or_bracket;
+
+        if (numbers)
+            _storage[offset - 1] = {type::number, size};
+        return {type::array, offset};
+    }
+
+    var_t parse_object(stream &s) {
+        if (_next == _sizes.size())
+            return error::missing_comma_or_bracket;
+        size_t size = _sizes[_next++] * 2;
+        if (!_storage.push_back({type::object, size}) || !_storage.resize(_storage.size() + size))
+            return error::out_of_memory;
+        size_t offset = _storage.size() - size, i = offset;
+        if (s.skipws() != '}') {
+        member:
+            if (s.peek() != '"')
+                return error::expecting_string;
+            s.getch();
+            var_t x = parse_key(s);
+            if (x.is_error())
+                return x;
+            if (i == offset + size)
+                return error::missing_comma_or_bracket;
+            _storage[i++] = x;
+
+            if (s.skipws() != ':')
+                return error::missing_colon;
+            s.getch();
+            x = parse_value(s);
+            if (x.is_error())
+                return x;
+            _storage[i++] = x;
+
+            if (s.skipws() == ',') {
+                s.getch();
+                s.skipws();
+                goto member;
+            }
+        }
+
+        if (s.getch() != '}' || i != offset + size)
+            return error::missing_comma_or_bracket;
+
+        return {type::object, offset};
+    }
+
+    var_t parse_string(stream &s) {
+        return _separate_strings ? parse_string(s, _strings) : parse_string(s, _storage);
+    }
+
+    var_t parse_key(stream &s) {
+        if (!_keys)
+            return parse_string(s);
+        var_t x = parse_string(s, _storage);
+        if (!x.is_error() && !x.is_inline()) {
+            const char *p = _storage[x.payload()].string;
+            size_t length = _storage[x.payload() - 1].payload();
+            const char *q = _keys->intern(p, length);
+            if (!q && _separate_strings) {
+                char *header = static_cast<char *>(_strings.allocate(sizeof(var_t) + length + 1));
+                if (!header)
+                    return error::out_of_memory;
+                memcpy(header, &_storage[x.payload() - 1], sizeof(var_t));
+                memcpy(header + sizeof(var_t), p, length + 1);
+                q = header + sizeof(var_t);
+            }
+            if (q) {
+                _storage.resize(x.payload() - 1);
+                x = var_t{q};
+            }
         }
+        return x;
     }
 
-    vector<var_t> _backlog;
-    vector<var_t> _storage;
+    // the blocks a segmented container has filled so far
+    struct segments {
+        var_t *first = nullptr;
+        var_t *last = nullptr;
+        size_t blocks = 0;
+    };
+
+    // moves a full block of elements from the backlog to the arena, so the
+    // backlog never holds more than a block for each open container; the
+    // first block has room for the table and header in front
+    bool flush(size_t frame, segments &c) {
+        const size_t n = var_t::segment_slots;
+        size_t lead = c.first ? 0 : 2;
+        var_t *p = static_cast<var_t *>(_strings.allocate(sizeof(var_t) * (lead + n + 1)));
+        if (!p)
+            return false;
+        p += lead;
+        memcpy(p, _backlog.begin() + frame, sizeof(var_t) * n);
+        _backlog.resize(frame);
+        if (c.last)
+            c.last[n] = var_t::link(p);
+        else
+            c.first = p;
+        c.last = p;
+        ++c.blocks;
+        return true;
+    }
+
+    // moves the elements gathered in the backlog since frame to storage, or
+    // to a segment that never moves, where they are addressed absolutely and
+    // followed by a null slot that iterators may read
+    var_t store(enum type t, size_t frame, enum type header, segments &c) {
+        size_t size = _backlog.size() - frame;
+        if (c.first)
+            return store_blocks(t, frame, header, c);
+        if (_segmented) {
+            var_t *p = static_cast<var_t *>(_strings.allocate(sizeof(var_t) * (size + 2)));
+            if (!p)
+                return error::out_of_memory;
+            p[0] = {header, size};
+            memcpy(p + 1, _backlog.begin() + frame, sizeof(var_t) * size);
+            p[size + 1] = type::null;
+            _backlog.resize(frame);
+            return {t, reinterpret_cast<uintptr_t>(p + 1) / sizeof(var_t)};
+        }
+        if (!_storage.push_back({header, size}) || !_storage.append(_backlog.begin() + frame, size))
+            return error::out_of_memory;
+        _backlog.resize(frame);
+        return {t, _storage.size() - size};
+    }
+
+    // adds the rest of the backlog as the last block and the table of blocks
+    var_t store_blocks(enum type t, size_t frame, enum type header, segments &c) {
+        const size_t n = var_t::segment_slots;
+        size_t rest = _backlog.size() - frame, size = c.blocks * n + rest;
+        if (rest) {
+            var_t *p = static_cast<var_t *>(_strings.allocate(sizeof(var_t) * (rest + 1)));
+            if (!p)
+                return error::out_of_memory;
+            memcpy(p, _backlog.begin() + frame, sizeof(var_t) * rest);
+            p[rest] = type::null;
+            _backlog.resize(frame);
+            c.last[n] = var_t::link(p);
+            c.last = p;
+            ++c.blocks;
+        } else {
+            c.last[n] = type::null;
+        }
+
+        const var_t **table = static_cast<const var_t **>(_strings.allocate(sizeof(var_t *) * c.blocks));
+        if (!table)
+            return error::out_of_memory;
+        table[0] = c.first;
+        for (size_t i = 1; i < c.blocks; ++i)
+            table[i] = table[i - 1][n].linked();
+        c.first[-2].bits = reinterpret_cast<uintptr_t>(table);
+        c.first[-1] = {header, size};
+        return {t, reinterpret_cast<uintptr_t>(c.first) / sizeof(var_t)};
+    }
 
     var_t parse_value(stream &s) {
         switch (s.skipws()) {
         case '"':
             s.getch();
-            return parse_string(s, _storage);
+            return parse_string(s);
         case 'f':
             s.getch();
             if (s.getch() == 'a' && s.getch() == 'l' && s.getch() == 's' && s.getch() == 'e')
@@ -449,12 +1549,21 @@ struct parser {
             return error::invalid_literal_name;
         case '[': {
             s.getch();
+            if (_prescan)
+                return parse_array(s);
             size_t frame = _backlog.size();
+            segments c;
+            bool numbers = true;
             if (s.skipws() != ']') {
             element:
-                _backlog.push_back(parse_value(s));
-                if (_backlog.back().is_error())
-                    return _backlog.back();
+                var_t x = parse_value(s);
+                if (x.is_error())
+                    return x;
+                if (!_backlog.push_back(x))
+                    return error::out_of_memory;
+                numbers &= x.is_number();
+                if (_segmented && _backlog.size() - frame == var_t::segment_slots && !flush(frame, c))
+                    return error::out_of_memory;
 
                 if (s.skipws() == ',') {
                     s.getch();
@@ -465,30 +1574,35 @@ struct parser {
             if (s.getch() != ']')
                 return error::missing_comma_or_bracket;
 
-            size_t size = _backlog.size() - frame;
-            _storage.push_back({type::array, size});
-            _storage.append(_backlog.begin() + frame, size);
-            _backlog.resize(frame);
-            return {type::array, _storage.size() - size};
+            return store(type::array, frame, numbers ? type::number : type::array, c);
         }
         case '{': {
             s.getch();
+            if (_prescan)
+                return parse_object(s);
             size_t frame = _backlog.size();
+            segments c;
             if (s.skipws() != '}') {
             member:
                 if (s.peek() != '"')
                     return error::expecting_string;
                 s.getch();
-                _backlog.push_back(parse_string(s, _storage));
-                if (_backlog.back().is_error())
-                    return _backlog.back();
+                var_t x = parse_key(s);
+                if (x.is_error())
+                    return x;
+                if (!_backlog.push_back(x))
+                    return error::out_of_memory;
 
                 if (s.skipws() != ':')
                     return error::missing_colon;
                 s.getch();
-                _backlog.push_back(parse_value(s));
-                if (_backlog.back().is_error())
-                    return _backlog.back();
+                x = parse_value(s);
+                if (x.is_error())
+                    return x;
+                if (!_backlog.push_back(x))
+                    return error::out_of_memory;
+                if (_segmented && _backlog.size() - frame == var_t::segment_slots && !flush(frame, c))
+                    return error::out_of_memory;
 
                 if (s.skipws() == ',') {
                     s.getch();
@@ -500,11 +1614,7 @@ struct parser {
             if (s.getch() != '}')
                 return error::missing_comma_or_bracket;
 
-            size_t size = _backlog.size() - frame;
-            _storage.push_back({type::object, size});
-            _storage.append(_backlog.begin() + frame, size);
-            _backlog.resize(frame);
-            return {type::object, _storage.size() - size};
+            return store(type::object, frame, type::object, c);
         }
         case '-':
             s.getch();
@@ -520,30 +1630,290 @@ struct parser {
     }
 };
 
-class document : public value {
-    vector<var_t> _storage;
+using parser = basic_parser<>;
+
+enum option : unsigned {
+    // keep string bytes in a separate arena, away from the structural slots
+    separate_strings = 1 << 0,
+    // size every container in a prescan of the input and write elements
+    // straight into storage, laid out in pre-order, instead of the backlog
+    prescan = 1 << 1,
+    // grow storage by fixed-size segments that never move, so large documents
+    // are never copied on growth; implies separate_strings, ignores prescan
+    segmented_storage = 1 << 2,
+};
+
+// what a document holds, in bytes: slots of containers and their headers,
+// strings with their headers, NULs and padding, and capacity not in use
+struct memory_stats {
+    size_t slots;
+    size_t strings;
+    size_t slack;
+
+    size_t total() const { return slots + strings + slack; }
+};
+
+template <typename Allocator = heap_allocator>
+class basic_document : public value {
+    vector<var_t, Allocator> _storage;
+    basic_arena<Allocator> _strings;
+    key_pool *_keys = nullptr;
+    size_t _error_offset = 0;
+    // bytes of segments whose containers compact() or deduplicate() moved
+    // to storage
+    size_t _abandoned = 0;
+
+    // appends what x references in storage to out, children after their parent
+    var_t relocate(vector<var_t, Allocator> &out, var_t x) const {
+        switch (x.type()) {
+        case type::string: {
+            size_t size = 1 + (slot(x.payload() - 1)->payload() + sizeof(var_t)) / sizeof(var_t);
+            if (!out.append(slot(x.payload() - 1), size))
+                return error::out_of_memory;
+            return {type::string, out.size() - size + 1};
+        }
+        case type::array:
+        case type::object: {
+            size_t size = slot(x.payload() - 1)->payload();
+            if (!segmented(size)) {
+                if (!out.append(slot(x.payload() - 1), size + 1))
+                    return error::out_of_memory;
+            } else {
+                if (!out.reserve(out.size() + size + 1) || !out.push_back(*slot(x.payload() - 1)))
+                    return error::out_of_memory;
+                for (size_t i = 0; i < size; ++i)
+                    out.push_back(*at(x.payload(), i));
+            }
+            size_t offset = out.size() - size;
+            for (size_t i = offset; i < offset + size; ++i) {
+                var_t y = relocate(out, out[i]);
+                if (y.is_error())
+                    return y;
+                out[i] = y;
+            }
+            return {x.type(), offset};
+        }
+        default:
+            return x;
+        }
+    }
+
+    // the slots of the containers under x, headers included; extra adds
+    // what they take besides in the arena of a segmented document: a null
+    // after each, and for those split into blocks a table slot, a link per
+    // block and the table itself
+    size_t container_slots(var_t x, size_t &extra) const {
+        if (x.type() != type::array && x.type() != type::object)
+            return 0;
+        size_t size = slot(x.payload() - 1)->payload(), n = 1 + size;
+        extra += 1;
+        if (segmented(size))
+            extra += 2 * ((size + var_t::segment_slots - 1) / var_t::segment_slots);
+        for (size_t i = 0; i < size; ++i)
+            n += container_slots(*at(x.payload(), i), extra);
+        return n;
+    }
+
+    size_t arena_slots(var_t x) const {
+        size_t extra = 0;
+        return container_slots(x, extra) + extra;
+    }
+
+    struct share_state {
+        struct entry {
+            size_t offset;
+            uint64_t hash;
+        };
+
+        vector<var_t, Allocator> out, backlog;
+        vector<entry, Allocator> table;
+        size_t count = 0;
+
+        explicit share_state(const Allocator &allocator) : out(allocator), backlog(allocator), table(allocator) {}
+    };
+
+    static uint64_t hash_slots(const var_t *p, size_t n) {
+        uint64_t h = n;
+        for (size_t i = 0; i < n; ++i) {
+            h = (h ^ p[i].bits) * 0x9E3779B97F4A7C15ull;
+            h ^= h >> 29;
+        }
+        return h;
+    }
+
+    // moves the record gathered in the backlog since frame to out, unless
+    // out holds an identical one already, which is then shared
+    static var_t intern(share_state &st, enum type t, size_t frame) {
+        const var_t *record = st.backlog.begin() + frame;
+        size_t n = st.backlog.size() - frame;
+        uint64_t h = hash_slots(record, n);
+        size_t mask = st.table.size() - 1, i = h & mask;
+        for (; st.table[i].offset; i = (i + 1) & mask) {
+            const var_t *p = st.out.begin() + st.table[i].offset - 1;
+            if (st.table[i].hash == h && p->bits == record->bits && !memcmp(p, record, n * sizeof(var_t))) {
+                st.backlog.resize(frame);
+                return {t, st.table[i].offset};
+            }
+        }
+        if (!st.out.append(record, n))
+            return error::out_of_memory;
+        st.backlog.resize(frame);
+        st.table[i] = {st.out.size() - n + 1, h};
+
+        if (++st.count * 2 > st.table.size()) {
+            vector<typename share_state::entry, Allocator> table(st.table.get_allocator());
+            if (!table.resize(st.table.size() * 2))
+                return error::out_of_memory;
+            memset(table.data(), 0, table.size() * sizeof(table[0]));
+            for (auto e : st.table) {
+                if (!e.offset)
+                    continue;
+                for (i = e.hash & (table.size() - 1); table[i].offset; i = (i + 1) & (table.size() - 1))
+                    ;
+                table[i] = e;
+            }
+            st.table = static_cast<vector<typename share_state::entry, Allocator> &&>(table);
+        }
+        return {t, st.out.size() - n + 1};
+    }
+
+    // rebuilds what x references bottom-up, so equal subtrees become equal
+    // slots and are interned as one
+    var_t share(share_state &st, var_t x) const {
+        size_t frame = st.backlog.size();
+        if (x.type() == type::string) {
+            if (x.is_unboxed_string())
+                return x;
+            size_t length = slot(x.payload() - 1)->payload();
+            size_t n = 1 + (length + sizeof(var_t)) / sizeof(var_t);
+            if (!st.backlog.resize(frame + n))
+                return error::out_of_memory;
+            // zero the padding so that equal strings have equal slots
+            st.backlog.back().bits = 0;
+            memcpy(&st.backlog[frame], slot(x.payload() - 1), sizeof(var_t) + length + 1);
+            return intern(st, type::string, frame);
+        }
+        if (x.type() != type::array && x.type() != type::object)
+            return x;
+        size_t size = slot(x.payload() - 1)->payload();
+        if (!st.backlog.push_back(*slot(x.payload() - 1)))
+            return error::out_of_memory;
+        for (size_t i = 0; i < size; ++i) {
+            var_t y = share(st, *at(x.payload(), i));
+            if (y.is_error() || !st.backlog.push_back(y))
+                return error::out_of_memory;
+        }
+        return intern(st, x.type(), frame);
+    }
 
 public:
-    bool parse(const char *json) {
+    basic_document() = default;
+    explicit basic_document(const Allocator &allocator) : _storage(allocator), _strings(allocator) {}
+    explicit basic_document(key_pool &keys, const Allocator &allocator = Allocator()) : _storage(allocator), _strings(allocator), _keys(&keys) {}
+
+    bool parse(const char *json, unsigned options = 0) {
         stream s{json};
-        parser p;
-        _data = p.parse_value(s);
+        basic_parser<Allocator> p(_storage.get_allocator());
+        p._keys = _keys;
+        p._separate_strings = (options & (separate_strings | segmented_storage)) != 0;
+        p._segmented = (options & segmented_storage) != 0;
+        if ((options & prescan) && !p._segmented && !p.prescan_sizes(json))
+            _data = error::out_of_memory;
+        else
+            _data = p.parse_value(s);
 
         if (!_data.is_error() && s.skipws())
             _data = error::unexpected_character;
 
         if (_data.is_error()) {
-            _data.payload = s.c_str() - json;
+            _error_offset = s.c_str() - json;
             return false;
         }
 
-        _storage = static_cast<vector<var_t> &&>(p._storage);
+        _storage = p._segmented ? vector<var_t, Allocator>(_storage.get_allocator()) : static_cast<vector<var_t, Allocator> &&>(p._storage);
+        _strings = static_cast<basic_arena<Allocator> &&>(p._strings);
+        _abandoned = 0;
         value::_storage = _storage.data();
 
         return true;
     }
 
-    error error_code() const { return _data.error; }
-    size_t error_offset() const { return _data.is_error() ? _data.payload : 0; }
+    // rewrites storage in pre-order, as the prescan option lays it out, so that
+    // a full traversal reads it almost sequentially; invalidates values taken
+    // from this document before, unless it runs out of memory and keeps
+    // the old layout
+    void compact() {
+        if (_data.is_error())
+            return;
+        vector<var_t, Allocator> out(_storage.get_allocator());
+        if (!out.reserve(_storage.size() ? _storage.size() : 1))
+            return;
+        var_t x = relocate(out, _data);
+        if (x.is_error())
+            return;
+        if (!value::_storage)
+            _abandoned += arena_slots(_data) * sizeof(var_t);
+        _data = x;
+        _storage = static_cast<vector<var_t, Allocator> &&>(out);
+        value::_storage = _storage.data();
+    }
+
+    memory_stats memory_usage() const {
+        size_t slots = 0, strings = 0, extra = 0;
+        if (value::_storage) {
+            // storage is a run of records, each a header and what it counts
+            for (size_t i = 0; i < _storage.size();) {
+                var_t header = _storage[i];
+                bool string = header.is_string();
+                size_t n = 1 + (string ? (header.payload() + sizeof(var_t)) / sizeof(var_t) : header.payload());
+                (string ? strings : slots) += n * sizeof(var_t);
+                i += n;
+            }
+            strings += _strings.used() - _abandoned;
+        } else {
+            // segmented documents keep their containers in the arena, and
+            // what the blocks need besides counts as slack
+            slots = container_slots(_data, extra) * sizeof(var_t);
+            extra *= sizeof(var_t);
+            strings = _strings.used() - slots - extra;
+        }
+        return {slots, strings, (_storage.capacity() - _storage.size()) * sizeof(var_t) + _strings.capacity() - _strings.used() + _abandoned + extra};
+    }
+
+    // stores identical subtrees and strings once and points every reference
+    // at that copy, which the read-only tree can share; returns the bytes
+    // saved. Invalidates values taken from this document before. compact()
+    // copies shared subtrees apart again.
+    size_t deduplicate() {
+        if (_data.is_error())
+            return 0;
+        share_state st(_storage.get_allocator());
+        if (!st.table.resize(1024))
+            return 0;
+        memset(st.table.data(), 0, st.table.size() * sizeof(st.table[0]));
+        var_t x = share(st, _data);
+        if (x.is_error())
+            return 0;
+        size_t extra = 0;
+        size_t before = value::_storage ? _storage.size() : container_slots(_data, extra);
+        if (!value::_storage)
+            _abandoned += (before + extra) * sizeof(var_t);
+        _data = x;
+        _storage = static_cast<vector<var_t, Allocator> &&>(st.out);
+        value::_storage = _storage.data();
+        return (before - _storage.size()) * sizeof(var_t);
+    }
+
+    // gives back storage the doubling growth reserved but did not use;
+    // invalidates values taken from this document before
+    void shrink_to_fit() {
+        if (_storage.capacity() > _storage.size() && _storage.set_capacity(_storage.size()))
+            value::_storage = _storage.data();
+    }
+
+    error error_code() const { return _data.error(); }
+    size_t error_offset() const { return _data.is_error() ? _error_offset : 0; }
 };
+
+using document = basic_document<>;
 } // namespace gason2
@@ -1,16 +1,725 @@
 #pragma once
 
 #include "gason2.h"
+#include <math.h>
 #include <stdio.h>
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 namespace gason2 {
+// Grisu2 (Loitsch, "Printing floating-point numbers quickly and accurately
+// with integers"): the shortest digits that read back as the same double in
+// all but a few cases, where it gives a longer string that still does.
+struct dtoa {
+    struct diy_fp {
+        uint64_t f;
+        int e;
+
+        diy_fp operator-(const diy_fp &x) const { return {f - x.f, e}; }
+
+        // the high 64 bits of the product, rounded
+        diy_fp operator*(const diy_fp &x) const {
+            const uint64_t mask = 0xFFFFFFFF;
+            uint64_t a = f >> 32, b = f & mask, c = x.f >> 32, d = x.f & mask;
+            uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+            uint64_t tmp = (bd >> 32) + (ad & mask) + (bc & mask) + (1u << 31);
+            return {ac + (ad >> 32) + (bc >> 32) + (tmp >> 32), e + x.e + 64};
+        }
+    };
+
+    static constexpr uint64_t hidden_bit = 0x0010000000000000ull;
+
+    static diy_fp normalize(diy_fp x) {
+        while (!(x.f & 0x8000000000000000ull)) {
+            x.f <<= 1;
+            --x.e;
+        }
+        return x;
+    }
+
+    // 10^k for k = -348, -340, ..., 340 with 64-bit significands
+    static diy_fp cached_power(int e, int &k) {
+        static const uint64_t significands[] = {
+            0xFA8FD5A0081C0288ull, 0xBAAEE17FA23EBF76ull, 0x8B16FB203055AC76ull, 0xCF42894A5DCE35EAull,
+            0x9A6BB0AA55653B2Dull, 0xE61ACF033D1A45DFull, 0xAB70FE17C79AC6CAull, 0xFF77B1FCBEBCDC4Full,
+            0xBE5691EF416BD60Cull, 0x8DD01FAD907FFC3Cull, 0xD3515C2831559A83ull, 0x9D71AC8FADA6C9B5ull,
+            0xEA9C227723EE8BCBull, 0xAECC49914078536Dull, 0x823C12795DB6CE57ull, 0xC21094364DFB5637ull,
+            0x9096EA6F3848984Full, 0xD77485CB25823AC7ull, 0xA086CFCD97BF97F4ull, 0xEF340A98172AACE5ull,
+            0xB23867FB2A35B28Eull, 0x84C8D4DFD2C63F3Bull, 0xC5DD44271AD3CDBAull, 0x936B9FCEBB25C996ull,
+            0xDBAC6C247D62A584ull, 0xA3AB66580D5FDAF6ull, 0xF3E2F893DEC3F126ull, 0xB5B5ADA8AAFF80B8ull,
+            0x87625F056C7C4A8Bull, 0xC9BCFF6034C13053ull, 0x964E858C91BA2655ull, 0xDFF9772470297EBDull,
+            0xA6DFBD9FB8E5B88Full, 0xF8A95FCF88747D94ull, 0xB94470938FA89BCFull, 0x8A08F0F8BF0F156Bull,
+            0xCDB02555653131B6ull, 0x993FE2C6D07B7FACull, 0xE45C10C42A2B3B06ull, 0xAA242499697392D3ull,
+            0xFD87B5F28300CA0Eull, 0xBCE5086492111AEBull, 0x8CBCCC096F5088CCull, 0xD1B71758E219652Cull,
+            0x9C40000000000000ull, 0xE8D4A51000000000ull, 0xAD78EBC5AC620000ull, 0x813F3978F8940984ull,
+            0xC097CE7BC90715B3ull, 0x8F7E32CE7BEA5C70ull, 0xD5D238A4ABE98068ull, 0x9F4F2726179A2245ull,
+            0xED63A231D4C4FB27ull, 0xB0DE65388CC8ADA8ull, 0x83C7088E1AAB65DBull, 0xC45D1DF942711D9Aull,
+            0x924D692CA61BE758ull, 0xDA01EE641A708DEAull, 0xA26DA3999AEF774Aull, 0xF209787BB47D6B85ull,
+            0xB454E4A179DD1877ull, 0x865B86925B9BC5C2ull, 0xC83553C5C8965D3Dull, 0x952AB45CFA97A0B3ull,
+            0xDE469FBD99A05FE3ull, 0xA59BC234DB398C25ull, 0xF6C69A72A3989F5Cull, 0xB7DCBF5354E9BECEull,
+            0x88FCF317F22241E2ull, 0xCC20CE9BD35C78A5ull, 0x98165AF37B2153DFull, 0xE2A0B5DC971F303Aull,
+            0xA8D9D1535CE3B396ull, 0xFB9B7CD9A4A7443Cull, 0xBB764C4CA7A44410ull, 0x8BAB8EEFB6409C1Aull,
+            0xD01FEF10A657842Cull, 0x9B10A4E5E9913129ull, 0xE7109BFBA19C0C9Dull, 0xAC2820D9623BF429ull,
+            0x80444B5E7AA7CF85ull, 0xBF21E44003ACDD2Dull, 0x8E679C2F5E44FF8Full, 0xD433179D9C8CB841ull,
+            0x9E19DB92B4E31BA9ull, 0xEB96BF6EBADF77D9ull, 0xAF87023B9BF0EE6Bull,
+        };
+        static const int16_t exponents[] = {
+            -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954, -927,
+            -901, -874, -847, -821, -794, -768, -741, -715, -688, -661, -635, -608,
+            -582, -555, -529, -502, -475, -449, -422, -396, -369, -343, -316, -289,
+            -263, -236, -210, -183, -157, -130, -103, -77, -50, -24, 3, 30,
+            56, 83, 109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+            375, 402, 428, 455, 481, 508, 534, 561, 588, 614, 641, 667,
+            694, 720, 747, 774, 800, 827, 853, 880, 907, 933, 960, 986,
+            1013, 1039, 1066,
+        };
+        double dk = (-61 - e) * 0.30102999566398114 + 347;
+        int i = static_cast<int>(dk);
+        if (dk - i > 0.0)
+            ++i;
+        unsigned index = static_cast<unsigned>((i >> 3) + 1);
+        k = -(-348 + static_cast<int>(index << 3));
+        return {significands[index], exponents[index]};
+    }
+
+    static void round_weed(char *buffer, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa, uint64_t wp_w) {
+        while (rest < wp_w && delta - rest >= ten_kappa && (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+            buffer[length - 1]--;
+            rest += ten_kappa;
+        }
+    }
+
+    static int digit_count(uint32_t n) {
+        int count = 1;
+        while (n >= 10 && count < 9) {
+            n /= 10;
+            ++count;
+        }
+        return count;
+    }
+
+    static void generate(diy_fp w, diy_fp mp, uint64_t delta, char *buffer, int &length, int &k) {
+        static const uint64_t pow10[] = {1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull, 1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull, 100000000000000ull, 1000000000000000ull, 10000000000000000ull, 100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull};
+        const diy_fp one = {1ull << -mp.e, mp.e};
+        const diy_fp wp_w = mp - w;
+        uint32_t p1 = static_cast<uint32_t>(mp.f >> -one.e);
+        uint64_t p2 = mp.f & (one.f - 1);
+        int kappa = digit_count(p1);
+        length = 0;
+
+        while (kappa > 0) {
+            uint32_t d = static_cast<uint32_t>(p1 / pow10[kappa - 1]);
+            p1 %= static_cast<uint32_t>(pow10[kappa - 1]);
+            if (d || length)
+                buffer[length++] = static_cast<char>('0' + d);
+            --kappa;
+            uint64_t rest = (static_cast<uint64_t>(p1) << -one.e) + p2;
+            if (rest <= delta) {
+                k += kappa;
+                round_weed(buffer, length, delta, rest, pow10[kappa] << -one.e, wp_w.f);
+                return;
+            }
+        }
+
+        for (;;) {
+            p2 *= 10;
+            delta *= 10;
+            char d = static_cast<char>(p2 >> -one.e);
+            if (d || length)
+                buffer[length++] = static_cast<char>('0' + d);
+            p2 &= one.f - 1;
+            --kappa;
+            if (p2 < delta) {
+                k += kappa;
+                round_weed(buffer, length, delta, p2, one.f, -kappa < 20 ? wp_w.f * pow10[-kappa] : 0);
+                return;
+            }
+        }
+    }
+
+    // digits of a positive finite x into buffer, such that x = digits * 10^k
+    static void grisu2(double x, char *buffer, int &length, int &k) {
+        uint64_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        int biased = static_cast<int>(bits >> 52);
+        diy_fp v = {bits & (hidden_bit - 1), 1 - 1075};
+        if (biased) {
+            v.f += hidden_bit;
+            v.e = biased - 1075;
+        }
+
+        // boundaries halfway to the neighbouring doubles
+        diy_fp plus = normalize({(v.f << 1) + 1, v.e - 1});
+        diy_fp minus = v.f == hidden_bit && biased > 1 ? diy_fp{(v.f << 2) - 1, v.e - 2} : diy_fp{(v.f << 1) - 1, v.e - 1};
+        minus.f <<= minus.e - plus.e;
+        minus.e = plus.e;
+
+        diy_fp c = cached_power(plus.e, k);
+        diy_fp w = normalize(v) * c;
+        diy_fp wp = plus * c, wm = minus * c;
+        ++wm.f;
+        --wp.f;
+        generate(w, wp, wp.f - wm.f, buffer, length, k);
+    }
+
+    static char *write_exponent(int k, char *p) {
+        if (k < 0) {
+            *p++ = '-';
+            k = -k;
+        }
+        if (k >= 100) {
+            *p++ = static_cast<char>('0' + k / 100);
+            k %= 100;
+            *p++ = static_cast<char>('0' + k / 10);
+        } else if (k >= 10) {
+            *p++ = static_cast<char>('0' + k / 10);
+        }
+        *p++ = static_cast<char>('0' + k % 10);
+        return p;
+    }
+
+    // places the decimal point in digits * 10^k the way %g would
+    static char *prettify(char *buffer, int length, int k) {
+        const int kk = length + k; // 10^(kk-1) <= x < 10^kk
+        if (k >= 0 && kk <= 21) {
+            // 1234e7 -> 12340000000
+            memset(buffer + length, '0', k);
+            return buffer + kk;
+        }
+        if (kk > 0 && kk <= 21) {
+            // 1234e-2 -> 12.34
+            memmove(buffer + kk + 1, buffer + kk, length - kk);
+            buffer[kk] = '.';
+            return buffer + length + 1;
+        }
+        if (kk > -6 && kk <= 0) {
+            // 1234e-6 -> 0.001234
+            const int offset = 2 - kk;
+            memmove(buffer + offset, buffer, length);
+            buffer[0] = '0';
+            buffer[1] = '.';
+            memset(buffer + 2, '0', offset - 2);
+            return buffer + length + offset;
+        }
+        if (length == 1) {
+            // 1e30
+            buffer[1] = 'e';
+            return write_exponent(kk - 1, buffer + 2);
+        }
+        // 1234e30 -> 1.234e33
+        memmove(buffer + 2, buffer + 1, length - 1);
+        buffer[1] = '.';
+        buffer[length + 1] = 'e';
+        return write_exponent(kk - 1, buffer + length + 2);
+    }
+
+    // writes x to buffer, which needs room for 25 characters, and returns
+    // the end; whole numbers below 2^53 skip Grisu altogether
+    static char *format(char *buffer, double x) {
+        char *p = buffer;
+        if (x == 0) {
+            if (signbit(x))
+                *p++ = '-';
+            *p++ = '0';
+            return p;
+        }
+        if (!isfinite(x))
+            return p + snprintf(p, 25, "%g", x);
+        if (x < 0) {
+            *p++ = '-';
+            x = -x;
+        }
+        if (x < 9007199254740992.0 && x == static_cast<double>(static_cast<uint64_t>(x))) {
+            char digits[20], *q = digits + sizeof(digits);
+            for (uint64_t n = static_cast<uint64_t>(x); n; n /= 10)
+                *--q = static_cast<char>('0' + n % 10);
+            size_t n = digits + sizeof(digits) - q;
+            memcpy(p, q, n);
+            return p + n;
+        }
+        int length, k;
+        grisu2(x, p, length, k);
+        return prettify(p, length, k);
+    }
+};
+
+// Output for dump that holds at most N bytes at a time and hands them to
+// sink(const char *, size_t), which returns false on failure; later output
+// is then dropped and flush() reports it.
+template <typename Sink, size_t N = 64 * 1024>
+class writer {
+    Sink _sink;
+    size_t _size = 0;
+    size_t _written = 0;
+    bool _good = true;
+    char _buffer[N];
+
+public:
+    explicit writer(Sink sink) : _sink(sink) {}
+    writer(const writer &) = delete;
+    writer &operator=(const writer &) = delete;
+
+    ~writer() {
+        flush();
+    }
+
+    bool flush() {
+        if (_size && _good)
+            _good = _sink(_buffer, _size);
+        _size = 0;
+        return _good;
+    }
+
+    void push_back(char c) {
+        if (_size == N)
+            flush();
+        _buffer[_size++] = c;
+        ++_written;
+    }
+
+    void append(const char *p, size_t n) {
+        _written += n;
+        if (n > N - _size) {
+            flush();
+            if (n >= N) {
+                _good = _good && _sink(p, n);
+                return;
+            }
+        }
+        memcpy(_buffer + _size, p, n);
+        _size += n;
+    }
+
+    // bytes written so far, buffered or not
+    size_t size() const { return _written; }
+    bool good() const { return _good; }
+};
+
+struct file_sink {
+    FILE *fp;
+
+    bool operator()(const char *p, size_t n) const { return fwrite(p, 1, n, fp) == n; }
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+struct fd_sink {
+    int fd;
+
+    bool operator()(const char *p, size_t n) const {
+        while (n) {
+            ssize_t written = write(fd, p, n);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            p += written;
+            n -= written;
+        }
+        return true;
+    }
+};
+
+// Output for dump that copies only what it generates: punctuation, numbers
+// and escaped strings go to a scratch buffer, while verbatim strings of at
+// least min_reference bytes are referenced where they lie in the document,
+// which has to outlive the iovecs.
+template <typename Allocator = heap_allocator>
+class basic_gather {
+    // base is null for the next size bytes of scratch, whose address may
+    // still change as it grows
+    struct piece {
+        const char *base;
+        size_t size;
+    };
+
+    vector<char, Allocator> _scratch;
+    vector<piece, Allocator> _pieces;
+    vector<iovec, Allocator> _iovecs;
+    size_t _size = 0;
+    size_t _min_reference;
+    bool _good = true;
+
+public:
+    explicit basic_gather(size_t min_reference = 64, const Allocator &allocator = Allocator())
+        : _scratch(allocator), _pieces(allocator), _iovecs(allocator), _min_reference(min_reference) {}
+
+    void push_back(char c) { append(&c, 1); }
+
+    void append(const char *p, size_t n) {
+        _size += n;
+        if (!n)
+            return;
+        if (!_good || !_scratch.append(p, n))
+            _good = false;
+        else if (!_pieces.empty() && !_pieces.back().base)
+            _pieces.back().size += n;
+        else
+            _good = _pieces.push_back({nullptr, n});
+    }
+
+    void reference(const char *p, size_t n) {
+        if (n < _min_reference)
+            return append(p, n);
+        _size += n;
+        _good = _good && _pieces.push_back({p, n});
+    }
+
+    void clear() {
+        _scratch.resize(0);
+        _pieces.resize(0);
+        _size = 0;
+        _good = true;
+    }
+
+    size_t size() const { return _size; }
+    size_t scratch_size() const { return _scratch.size(); }
+    bool good() const { return _good; }
+
+    // the output so far, valid until this object changes; empty when it
+    // ran out of memory
+    const vector<iovec, Allocator> &iovecs() {
+        _iovecs.resize(0);
+        if (!_good || !_iovecs.reserve(_pieces.size()))
+            return _iovecs;
+        const char *scratch = _scratch.data();
+        for (const piece &i : _pieces) {
+            const char *base = i.base ? i.base : scratch;
+            if (!i.base)
+                scratch += i.size;
+            _iovecs.push_back({const_cast<char *>(base), i.size});
+        }
+        return _iovecs;
+    }
+
+    // writes the output to fd with writev, IOV_MAX vectors at a time
+    bool write(int fd) {
+#ifdef IOV_MAX
+        const size_t batch = IOV_MAX;
+#else
+        const size_t batch = 1024;
+#endif
+        iovecs();
+        if (!_good)
+            return false;
+        iovec *first = _iovecs.begin(), *last = _iovecs.end();
+        while (first != last) {
+            int count = static_cast<int>(last - first < ptrdiff_t(batch) ? last - first : batch);
+            ssize_t written = writev(fd, first, count);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            size_t n = written;
+            for (; first != last && n >= first->iov_len; ++first)
+                n -= first->iov_len;
+            if (n) {
+                first->iov_base = static_cast<char *>(first->iov_base) + n;
+                first->iov_len -= n;
+            }
+        }
+        return true;
+    }
+};
+
+using gather = basic_gather<>;
+#endif
+
+// Output for dump that only counts the bytes it would have written
+class counter {
+    size_t _size = 0;
+
+public:
+    void push_back(char) { ++_size; }
+    void append(const char *, size_t n) { _size += n; }
+    size_t size() const { return _size; }
+};
+
+// Output for dump that writes through a raw pointer; the caller makes room
+// beforehand, e.g. with dump::measure, and only debug builds check it
+class cursor {
+    char *_first, *_next, *_last;
+
+public:
+    cursor(char *buffer, size_t n) : _first(buffer), _next(buffer), _last(buffer + n) {}
+
+    void push_back(char c) {
+        assert(_next != _last);
+        *_next++ = c;
+    }
+
+    void append(const char *p, size_t n) {
+        assert(n <= size_t(_last - _next));
+        memcpy(_next, p, n);
+        _next += n;
+    }
+
+    size_t size() const { return _next - _first; }
+};
+
+// Compile-time choices for dump::write. Derive from one of these and hide
+// what should differ; each combination is compiled on its own, with the
+// choices folded away.
+struct compact_format {
+    static constexpr bool pretty = false;
+    static constexpr size_t indent_width = 4;
+    static constexpr char indent_char = ' ';
+    // \uXXXX for every character outside ASCII, surrogate pairs above U+FFFF
+    static constexpr bool ascii = false;
+    // members ordered by the bytes of their names, equal names as they came
+    static constexpr bool sort_keys = false;
+
+    // writes x at buf, which has room for 32 bytes, and returns the end
+    static char *number(char *buf, double x) { return dtoa::format(buf, x); }
+};
+
+struct pretty_format : compact_format {
+    static constexpr bool pretty = true;
+};
+
+struct ascii_format : compact_format {
+    static constexpr bool ascii = true;
+};
+
+// Output is vector<char>, a writer, or anything else with push_back(char),
+// append(const char *, size_t) and size()
 struct dump {
-    static void stringify(vector<char> &s, value v) {
+    // offset of the first byte in [p, last) that needs escaping, or last - p;
+    // with ascii, bytes from 0x80 up count as needing it too
+    template <bool ascii = false>
+    static size_t clean_prefix(const char *p, const char *last) {
+        const char *first = p;
+#ifdef __SSE2__
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1F);
+        for (; last - p >= 16; p += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            // unsigned x <= 0x1F exactly when max(x, 0x1F) == 0x1F
+            __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, backslash)),
+                                           _mm_cmpeq_epi8(_mm_max_epu8(x, control), control));
+            // the sign bits are the bytes outside ASCII
+            if (ascii)
+                special = _mm_or_si128(special, x);
+            if (int mask = _mm_movemask_epi8(special))
+                return p - first + parser::count_trailing_zeros(static_cast<unsigned>(mask));
+        }
+#endif
+        for (; p != last; ++p) {
+            unsigned char c = *p;
+            if (c < 0x20 || c == '"' || c == '\\' || (ascii && c >= 0x80))
+                break;
+        }
+        return p - first;
+    }
+
+    // whether [p, p + n) is all 7-bit; verbatim strings that are then need
+    // no further look in ASCII output
+    static bool is_ascii(const char *p, size_t n) {
+        const char *last = p + n;
+#ifdef __SSE2__
+        __m128i high = _mm_setzero_si128();
+        for (; last - p >= 16; p += 16)
+            high = _mm_or_si128(high, _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+        if (_mm_movemask_epi8(high))
+            return false;
+#endif
+        uint64_t word = 0;
+        for (; last - p >= 8; p += 8) {
+            uint64_t x;
+            memcpy(&x, p, sizeof(x));
+            word |= x;
+        }
+        for (; p != last; ++p)
+            word |= static_cast<unsigned char>(*p);
+        return !(word & 0x8080808080808080ull);
+    }
+
+    // verbatim strings outlive the value that names them, so outputs that
+    // can point at bytes instead of copying them get the chance to
+    template <typename Output>
+    static void reference(Output &s, const char *p, size_t n) {
+        s.append(p, n);
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    template <typename Allocator>
+    static void reference(basic_gather<Allocator> &s, const char *p, size_t n) {
+        s.reference(p, n);
+    }
+#endif
+
+    // appends str with the escapes JSON requires, copying clean runs whole
+    template <typename Output>
+    static void escape(Output &s, string_view str) {
+        static const char hex[] = "0123456789abcdef";
+        const char *p = str.begin(), *last = str.end();
+        for (;;) {
+            size_t n = clean_prefix(p, last);
+            s.append(p, n);
+            p += n;
+            if (p == last)
+                break;
+            unsigned char c = *p++;
+            switch (c) {
+            case '\b':
+                s.append("\\b", 2);
+                break;
+            case '\f':
+                s.append("\\f", 2);
+                break;
+            case '\n':
+                s.append("\\n", 2);
+                break;
+            case '\r':
+                s.append("\\r", 2);
+                break;
+            case '\t':
+                s.append("\\t", 2);
+                break;
+            case '\\':
+                s.append("\\\\", 2);
+                break;
+            case '"':
+                s.append("\\\"", 2);
+                break;
+            default: {
+                char u[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                s.append(u, sizeof(u));
+            }
+            }
+        }
+    }
+
+    // appends str like escape, but with every character outside ASCII as
+    // \uXXXX; bytes that are not UTF-8 come out as U+FFFD one by one, and
+    // so do overlong forms and surrogates
+    template <typename Output>
+    static void escape_ascii(Output &s, string_view str) {
+        static const char hex[] = "0123456789abcdef";
+        // the smallest code point each length may encode
+        static const unsigned least[] = {0, 0, 0x80, 0x800, 0x10000};
+        const char *p = str.begin(), *last = str.end();
+        for (;;) {
+            size_t clean = clean_prefix<true>(p, last);
+            s.append(p, clean);
+            p += clean;
+            if (p == last)
+                break;
+            if (static_cast<unsigned char>(*p) < 0x80) {
+                escape(s, {p++, 1});
+                continue;
+            }
+
+            unsigned c = static_cast<unsigned char>(*p);
+            size_t n = c >= 0xF5 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC2 ? 2 : 1;
+            unsigned code = c & (0x7F >> n);
+            for (size_t i = 1; i < n; ++i) {
+                if (i == size_t(last - p) || (p[i] & 0xC0) != 0x80) {
+                    n = 1;
+                    break;
+                }
+                code = code << 6 | (p[i] & 0x3F);
+            }
+            if (n == 1 || code < least[n] || code > 0x10FFFF || (code >= 0xD800 && code < 0xE000)) {
+                code = 0xFFFD;
+                n = 1;
+            }
+            p += n;
+
+            char u[12];
+            size_t length = 6;
+            if (code >= 0x10000) {
+                unsigned high = 0xD800 + ((code - 0x10000) >> 10);
+                u[0] = '\\', u[1] = 'u', u[2] = hex[high >> 12], u[3] = hex[high >> 8 & 15], u[4] = hex[high >> 4 & 15], u[5] = hex[high & 15];
+                code = 0xDC00 + (code & 0x3FF);
+                length = 12;
+            }
+            char *q = u + length - 6;
+            q[0] = '\\', q[1] = 'u', q[2] = hex[code >> 12], q[3] = hex[code >> 8 & 15], q[4] = hex[code >> 4 & 15], q[5] = hex[code & 15];
+            s.append(u, length);
+        }
+    }
+
+    // a line break and depth levels of indentation, when Format is pretty
+    template <typename Format, typename Output>
+    static void newline(Output &s, size_t depth) {
+        if (!Format::pretty)
+            return;
+        char pad[32];
+        memset(pad, Format::indent_char, sizeof(pad));
+        s.push_back('\n');
+        for (size_t n = depth * Format::indent_width; n;) {
+            size_t chunk = n < sizeof(pad) ? n : sizeof(pad);
+            s.append(pad, chunk);
+            n -= chunk;
+        }
+    }
+
+    // orders member names by their bytes, a prefix first
+    static int compare_names(const value::member &a, const value::member &b) {
+        // short names live in the values, so keep those around
+        value m = a.name(), n = b.name();
+        string_view x = m.to_string_view(), y = n.to_string_view();
+        int order = memcmp(x.data(), y.data(), x.size() < y.size() ? x.size() : y.size());
+        return order ? order : (x.size() > y.size()) - (x.size() < y.size());
+    }
+
+    template <typename Format, typename Output>
+    static void write_member(Output &s, value::member m, char comma, size_t depth) {
+        s.push_back(comma);
+        newline<Format>(s, depth + 1);
+        write<Format>(s, m.name(), depth + 1);
+        if (Format::pretty)
+            s.append(": ", 2);
+        else
+            s.push_back(':');
+        write<Format>(s, m.value(), depth + 1);
+    }
+
+    // the members of a non-empty object in the order sort_keys asks for,
+    // without memory to sort in: each scan finds the member after the last
+    // one written, by name and then by position
+    template <typename Format, typename Output>
+    static void write_sorted_in_place(Output &s, value v, size_t depth) {
+        value::member last, next;
+        char comma = '{';
+        for (size_t k = 0, previous = 0, n = v.size(); k < n; ++k) {
+            size_t position = 0, j = 0;
+            bool found = false;
+            for (auto i : v.members()) {
+                int order = k ? compare_names(i, last) : 1;
+                if ((order > 0 || (!order && j > previous)) && (!found || compare_names(i, next) < 0)) {
+                    next = i;
+                    position = j;
+                    found = true;
+                }
+                ++j;
+            }
+            write_member<Format>(s, next, comma, depth);
+            comma = ',';
+            last = next;
+            previous = position;
+        }
+    }
+
+    template <typename Format, typename Output>
+    static void write(Output &s, value v, size_t depth = 0) {
         char buf[32];
 
         switch (v.type()) {
         case type::number:
-            s.append(buf, snprintf(buf, sizeof(buf), "%.10g", v.to_number()));
+            s.append(buf, Format::number(buf, v.to_number()) - buf);
             break;
 
         case type::null:
@@ -26,34 +735,12 @@ struct dump {
 
         case type::string:
             s.push_back('"');
-            for (const char *p = v.to_string(); *p;) {
-                char c = *p++;
-                switch (c) {
-                case '\b':
-                    s.append("\\b", 2);
-                    break;
-                case '\f':
-                    s.append("\\f", 2);
-                    break;
-                case '\n':
-                    s.append("\\n", 2);
-                    break;
-                case '\r':
-                    s.append("\\r", 2);
-                    break;
-                case '\t':
-                    s.append("\\t", 2);
-                    break;
-                case '\\':
-                    s.append("\\\\", 2);
-                    break;
-                case '"':
-                    s.append("\\\"", 2);
-                    break;
-                default:
-                    s.push_back(c);
-                }
-            }
+            if (Format::ascii && !(v.is_verbatim() && is_ascii(v.to_string(), v.string_length())))
+                escape_ascii(s, v.to_string_view());
+            else if (v.is_verbatim())
+                reference(s, v.to_string(), v.string_length());
+            else
+                escape(s, v.to_string_view());
             s.push_back('"');
             break;
 
@@ -62,9 +749,11 @@ struct dump {
                 char comma = '[';
                 for (auto i : v.elements()) {
                     s.push_back(comma);
-                    stringify(s, i);
+                    newline<Format>(s, depth + 1);
+                    write<Format>(s, i, depth + 1);
                     comma = ',';
                 }
+                newline<Format>(s, depth);
             } else {
                 s.push_back('[');
             }
@@ -74,13 +763,26 @@ struct dump {
         case type::object:
             if (v.size()) {
                 char comma = '{';
-                for (auto i : v.members()) {
-                    s.push_back(comma);
-                    stringify(s, i.name());
-                    s.push_back(':');
-                    stringify(s, i.value());
-                    comma = ',';
+                vector<value::member> sorted;
+                if (Format::sort_keys && sorted.reserve(v.size())) {
+                    for (auto i : v.members())
+                        sorted.push_back(i);
+                    std::stable_sort(sorted.begin(), sorted.end(), [](const value::member &a, const value::member &b) {
+                        return compare_names(a, b) < 0;
+                    });
+                    for (const value::member &i : sorted) {
+                        write_member<Format>(s, i, comma, depth);
+                        comma = ',';
+                    }
+                } else if (Format::sort_keys) {
+                    write_sorted_in_place<Format>(s, v, depth);
+                } else {
+                    for (auto i : v.members()) {
+                        write_member<Format>(s, i, comma, depth);
+                        comma = ',';
+                    }
                 }
+                newline<Format>(s, depth);
             } else {
                 s.push_back('{');
             }
@@ -91,55 +793,201 @@ struct dump {
         }
     }
 
-    static void indent(vector<char> &s, size_t depth) {
-        if (s.size())
-            s.push_back('\n');
-        while (depth--)
-            s.append("\x20\x20\x20\x20", 4);
+    template <typename Output>
+    static void stringify(Output &s, value v) {
+        write<compact_format>(s, v);
     }
 
-    static void prettify(vector<char> &s, value v, size_t depth = 0) {
-        switch (v.type()) {
-        case type::array:
-            if (v.size()) {
-                char comma = '[';
-                for (auto i : v.elements()) {
-                    s.push_back(comma);
-                    indent(s, depth + 1);
-                    prettify(s, i, depth + 1);
-                    comma = ',';
-                }
-                indent(s, depth);
+    template <typename Output>
+    static void prettify(Output &s, value v, size_t depth = 0) {
+        write<pretty_format>(s, v, depth);
+    }
+
+    // containers with fewer elements than twice this are not worth a thread
+    static constexpr size_t parallel_grain = 1024;
+
+    // stringify and prettify, with the elements of large containers spread
+    // over threads (all cores by default) that write into buffers of their
+    // own, taken from allocator; the output is the same byte for byte, since
+    // a chunk whose buffer runs out of memory is written again straight to s
+    template <typename Output, typename Allocator = heap_allocator>
+    static void stringify_parallel(Output &s, value v, unsigned threads = 0, const Allocator &allocator = Allocator()) {
+        parallel<compact_format>(s, v, threads ? threads : std::thread::hardware_concurrency(), allocator);
+    }
+
+    template <typename Output, typename Allocator = heap_allocator>
+    static void prettify_parallel(Output &s, value v, unsigned threads = 0, const Allocator &allocator = Allocator()) {
+        parallel<pretty_format>(s, v, threads ? threads : std::thread::hardware_concurrency(), allocator);
+    }
+
+    // n elements, or members, of a large container, written as the serial
+    // loop would: opened with the container's bracket if they come first,
+    // with a comma otherwise
+    struct chunk {
+        value::iterator<1, value> elements;
+        value::iterator<2, value::member> members;
+        size_t n, depth;
+        char open;
+        bool object;
+    };
+
+    // a chunk's buffer, which remembers running out of memory
+    template <typename Allocator>
+    struct chunk_output {
+        vector<char, Allocator> buffer;
+        bool good = true;
+
+        explicit chunk_output(const Allocator &allocator) : buffer(allocator) {}
+        size_t size() const { return buffer.size(); }
+        void push_back(char c) { good = buffer.push_back(c) && good; }
+        void append(const char *p, size_t n) { good = buffer.append(p, n) && good; }
+    };
+
+    template <typename Format, typename Output>
+    static void write_chunk(Output &s, const chunk &c) {
+        auto e = c.elements;
+        auto m = c.members;
+        for (size_t i = 0; i < c.n; ++i) {
+            if (c.object) {
+                write_member<Format>(s, *m++, i ? ',' : c.open, c.depth);
             } else {
-                s.push_back('[');
+                s.push_back(i ? ',' : c.open);
+                newline<Format>(s, c.depth + 1);
+                write<Format>(s, *e++, c.depth + 1);
             }
-            s.push_back(']');
-            break;
+        }
+    }
 
-        case type::object:
-            if (v.size()) {
-                char comma = '{';
+    // cuts the large containers inside v into chunks, in document order;
+    // small containers may still hold large ones
+    static void split(std::vector<chunk> &chunks, value v, unsigned threads, size_t depth) {
+        size_t n = v.size();
+        if (n < 2 * parallel_grain) {
+            if (v.is_object())
+                for (auto i : v.members())
+                    split(chunks, i.value(), threads, depth + 1);
+            else if (v.is_array())
+                for (auto i : v.elements())
+                    split(chunks, i, threads, depth + 1);
+            return;
+        }
+
+        size_t count = threads * 4 < n / parallel_grain ? threads * 4 : n / parallel_grain;
+        chunk c = {v.elements().begin(), v.members().begin(), 0, depth, v.is_object() ? '{' : '[', v.is_object()};
+        for (size_t k = 1, i = 0; k <= count; ++k, c.open = ',') {
+            c.n = k * n / count - i;
+            chunks.push_back(c);
+            for (; i < k * n / count; ++i)
+                if (c.object)
+                    ++c.members;
+                else
+                    ++c.elements;
+        }
+    }
+
+    // writes v around the chunks, which the workers have finished
+    template <typename Format, typename Output, typename Buffer>
+    static void assemble(Output &s, value v, const chunk *chunks, Buffer *outputs, size_t &next, size_t depth) {
+        size_t n = v.size();
+        if (n < 2 * parallel_grain) {
+            if (!n) {
+                write<Format>(s, v, depth);
+                return;
+            }
+            char comma = v.is_object() ? '{' : '[';
+            if (v.is_object()) {
                 for (auto i : v.members()) {
                     s.push_back(comma);
-                    indent(s, depth + 1);
-                    stringify(s, i.name());
-                    s.append(": ", 2);
-                    prettify(s, i.value(), depth + 1);
+                    newline<Format>(s, depth + 1);
+                    write<Format>(s, i.name(), depth + 1);
+                    if (Format::pretty)
+                        s.append(": ", 2);
+                    else
+                        s.push_back(':');
+                    assemble<Format>(s, i.value(), chunks, outputs, next, depth + 1);
                     comma = ',';
                 }
-                indent(s, depth);
             } else {
-                s.push_back('{');
+                for (auto i : v.elements()) {
+                    s.push_back(comma);
+                    newline<Format>(s, depth + 1);
+                    assemble<Format>(s, i, chunks, outputs, next, depth + 1);
+                    comma = ',';
+                }
             }
-            s.push_back('}');
-            break;
+        } else {
+            for (size_t done = 0; done < n; done += chunks[next++].n) {
+                if (outputs[next].good)
+                    s.append(outputs[next].buffer.data(), outputs[next].buffer.size());
+                else
+                    write_chunk<Format>(s, chunks[next]);
+                outputs[next].buffer.set_capacity(0);
+            }
+        }
+        newline<Format>(s, depth);
+        s.push_back(v.is_object() ? '}' : ']');
+    }
 
-        default:
-            stringify(s, v);
+    // one set of workers per call takes the chunks of every large container
+    template <typename Format, typename Output, typename Allocator>
+    static void parallel(Output &s, value v, unsigned threads, const Allocator &allocator) {
+        std::vector<chunk> chunks;
+        if (threads > 1)
+            split(chunks, v, threads, 0);
+        if (chunks.empty()) {
+            write<Format>(s, v);
+            return;
         }
+
+        std::vector<chunk_output<Allocator>> outputs;
+        outputs.reserve(chunks.size());
+        for (size_t k = 0; k < chunks.size(); ++k)
+            outputs.emplace_back(allocator);
+
+        std::atomic<size_t> next(0);
+        auto work = [&] {
+            for (size_t k; (k = next++) < chunks.size();) {
+                write_chunk<Format>(outputs[k], chunks[k]);
+                // assemble writes it again, so make room for the others
+                if (!outputs[k].good)
+                    outputs[k].buffer.set_capacity(0);
+            }
+        };
+        size_t spawned = threads - 1 < chunks.size() ? threads - 1 : chunks.size();
+        std::unique_ptr<std::thread[]> pool(new std::thread[spawned]);
+        for (size_t t = 0; t < spawned; ++t)
+            pool[t] = std::thread(work);
+        work();
+        for (size_t t = 0; t < spawned; ++t)
+            pool[t].join();
+
+        size_t k = 0;
+        assemble<Format>(s, v, chunks.data(), outputs.data(), k, 0);
     }
 
-    static int format_error(char *str, size_t n, const char *filename, const char *json, const document &doc) {
+    // the exact number of bytes stringify, or prettify, writes for v
+    static size_t measure(value v, bool pretty = false) {
+        counter c;
+        if (pretty)
+            prettify(c, v);
+        else
+            stringify(c, v);
+        return c.size();
+    }
+
+    // writes v to buffer, which has to hold measure(v, pretty) bytes, and
+    // returns the length; nothing is NUL-terminated
+    static size_t stringify_into(char *buffer, size_t size, value v, bool pretty = false) {
+        cursor out(buffer, size);
+        if (pretty)
+            prettify(out, v);
+        else
+            stringify(out, v);
+        return out.size();
+    }
+
+    template <typename Allocator>
+    static int format_error(char *str, size_t n, const char *filename, const char *json, const basic_document<Allocator> &doc) {
         int lineno = 1;
         const char *left = json;
         const char *right = json;
@@ -171,13 +1019,15 @@ struct dump {
         case error::missing_colon: desc = "missing colon"; break;
         case error::missing_comma_or_bracket: desc = "missing comma or bracket"; break;
         case error::unexpected_character: desc = "unexpected character"; break;
+        case error::out_of_memory: desc = "out of memory"; break;
         }
         // clang-format on
 
         return snprintf(str, n, "%s:%d:%d: error: %s\n%.*s\n%*s\n", filename, lineno, column, desc, int(right - left), left, int(endptr - left), "^");
     }
 
-    static int print_error(const char *filename, const char *json, const document &doc) {
+    template <typename Allocator>
+    static int print_error(const char *filename, const char *json, const basic_document<Allocator> &doc) {
         char buffer[256];
         int n = format_error(buffer, sizeof(buffer), filename, json, doc);
         if (n > 0)
@@ -185,4 +1035,204 @@ struct dump {
         return n;
     }
 };
+
+// Writes v in pieces: each produce() call fills as much of the buffer as it
+// can and the next one carries on from there, so a non-blocking socket gets
+// only what it accepts. The walk keeps its own stack of containers instead
+// of recursing, and apart from that holds one queued token at a time.
+template <typename Allocator = heap_allocator>
+class basic_serializer {
+    struct frame {
+        value::iterator<1, value> element, elements_end;
+        value::iterator<2, value::member> member, members_end;
+        bool object;
+        bool first;
+        bool named; // the member's name is out, its value is next
+    };
+
+    enum kind { bytes, padding, escaped };
+
+    struct piece {
+        kind what;
+        const char *first;
+        size_t size;
+    };
+
+    vector<frame, Allocator> _stack;
+    value _root;
+    value _string; // holds the characters of inline strings
+    piece _queue[8];
+    size_t _head = 0, _tail = 0;
+    char _small[64];
+    size_t _used = 0;
+    char _escape[8];
+    size_t _escape_first = 0, _escape_last = 0;
+    bool _pretty;
+    bool _started = false;
+    bool _good = true;
+
+    void emit(const char *p, size_t n) {
+        if (_tail && _queue[_tail - 1].what == bytes && _queue[_tail - 1].first + _queue[_tail - 1].size == _small + _used)
+            _queue[_tail - 1].size += n;
+        else
+            _queue[_tail++] = {bytes, _small + _used, n};
+        memcpy(_small + _used, p, n);
+        _used += n;
+    }
+
+    void newline(size_t depth) {
+        emit("\n", 1);
+        if (depth)
+            _queue[_tail++] = {padding, nullptr, pretty_format::indent_width * depth};
+    }
+
+    void string(value v) {
+        _string = v;
+        emit("\"", 1);
+        _queue[_tail++] = {v.is_verbatim() ? bytes : escaped, _string.to_string(), _string.string_length()};
+        emit("\"", 1);
+    }
+
+    void begin(value v) {
+        switch (v.type()) {
+        case type::number: {
+            char buf[32];
+            emit(buf, dtoa::format(buf, v.to_number()) - buf);
+            break;
+        }
+        case type::null:
+            emit("null", 4);
+            break;
+        case type::boolean:
+            if (v.to_bool())
+                emit("true", 4);
+            else
+                emit("false", 5);
+            break;
+        case type::string:
+            string(v);
+            break;
+        case type::array:
+            if (!v.size())
+                emit("[]", 2);
+            else if (!_stack.push_back({v.elements().begin(), v.elements().end(), {}, {}, false, true, false}))
+                _good = false;
+            break;
+        case type::object:
+            if (!v.size())
+                emit("{}", 2);
+            else if (!_stack.push_back({{}, {}, v.members().begin(), v.members().end(), true, true, false}))
+                _good = false;
+            break;
+        default:
+            break;
+        }
+    }
+
+    // queues the next token or two; false when everything is out
+    bool step() {
+        _head = _tail = _used = 0;
+        if (!_started) {
+            _started = true;
+            begin(_root);
+            return _good;
+        }
+        if (_stack.empty() || !_good)
+            return false;
+
+        frame &f = _stack.back();
+        if (f.named) {
+            f.named = false;
+            begin((*f.member++).value());
+            return _good;
+        }
+        if (f.object ? f.member == f.members_end : f.element == f.elements_end) {
+            char close = f.object ? '}' : ']';
+            _stack.pop_back();
+            if (_pretty)
+                newline(_stack.size());
+            emit(&close, 1);
+            return true;
+        }
+
+        char comma = f.first ? (f.object ? '{' : '[') : ',';
+        f.first = false;
+        emit(&comma, 1);
+        if (_pretty)
+            newline(_stack.size());
+        if (f.object) {
+            f.named = true;
+            string((*f.member).name());
+            emit(": ", _pretty ? 2 : 1);
+        } else {
+            begin(*f.element++);
+        }
+        return _good;
+    }
+
+public:
+    explicit basic_serializer(value v, bool pretty = false, const Allocator &allocator = Allocator())
+        : _stack(allocator), _root(v), _pretty(pretty) {}
+
+    // writes up to size bytes to buffer and returns how many; less than
+    // size only once the whole value is out or memory ran out
+    size_t produce(char *buffer, size_t size) {
+        char pad[32];
+        memset(pad, pretty_format::indent_char, sizeof(pad));
+        char *out = buffer, *last = buffer + size;
+        while (out != last) {
+            if (_head == _tail) {
+                if (!step())
+                    break;
+                continue;
+            }
+
+            piece &p = _queue[_head];
+            size_t room = last - out;
+            if (_escape_first != _escape_last) {
+                size_t n = _escape_last - _escape_first < room ? _escape_last - _escape_first : room;
+                memcpy(out, _escape + _escape_first, n);
+                out += n;
+                _escape_first += n;
+                continue;
+            }
+
+            size_t n = p.size < room ? p.size : room;
+            switch (p.what) {
+            case bytes:
+                memcpy(out, p.first, n);
+                break;
+            case padding:
+                n = n < sizeof(pad) ? n : sizeof(pad);
+                memcpy(out, pad, n);
+                break;
+            case escaped:
+                n = dump::clean_prefix(p.first, p.first + n);
+                memcpy(out, p.first, n);
+                if (n < p.size && n < room) {
+                    cursor c(_escape, sizeof(_escape));
+                    dump::escape(c, {p.first + n, 1});
+                    _escape_first = 0;
+                    _escape_last = c.size();
+                    ++p.first;
+                    --p.size;
+                }
+                break;
+            }
+            out += n;
+            p.size -= n;
+            if (p.what != padding)
+                p.first += n;
+            if (!p.size && _escape_first == _escape_last)
+                ++_head;
+        }
+        return out - buffer;
+    }
+
+    // whether produce() has written everything
+    bool done() const { return _started && _stack.empty() && _head == _tail && _escape_first == _escape_last; }
+    bool good() const { return _good; }
+};
+
+using serializer = basic_serializer<>;
 } // namespace gason2
@@ -0,0 +1,185 @@
+#include "gason2.h"
+#include "gason2dump.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+struct Layout {
+    const char *name;
+    unsigned options;
+    bool compact;
+};
+
+static const Layout layouts[] = {
+    {"default", 0, false},
+    {"strings", gason2::separate_strings, false},
+    {"prescan", gason2::prescan, false},
+    {"compact", 0, true},
+    {"segments", gason2::segmented_storage, false},
+};
+
+// visits every node without looking at string contents
+static size_t Walk(const gason2::value &v) {
+    size_t n = 1;
+    switch (v.type()) {
+    case gason2::type::array:
+        for (auto i : v.elements())
+            n += Walk(i);
+        break;
+    case gason2::type::object:
+        for (auto i : v.members())
+            n += Walk(i.value());
+        break;
+    default:
+        break;
+    }
+    return n;
+}
+
+template <typename F>
+static double Measure(int iterations, F f) {
+    double best = 1e300;
+    for (int i = 0; i < iterations; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed.count() < best)
+            best = elapsed.count();
+    }
+    return best;
+}
+
+// resident set size in bytes, where the platform tells us
+static size_t Resident() {
+    size_t pages = 0;
+#ifdef __linux__
+    if (FILE *fp = fopen("/proc/self/statm", "r")) {
+        if (fscanf(fp, "%*s %zu", &pages) != 1)
+            pages = 0;
+        fclose(fp);
+    }
+    pages *= sysconf(_SC_PAGESIZE);
+#endif
+    return pages;
+}
+
+// grows a vector one slot per node, as the parser grows its storage, and
+// reports the best time and the most memory it made resident
+template <typename Allocator>
+static void Grow(const char *name, int iterations, size_t slots, const char *filename) {
+    size_t resident = 0;
+    double grow = Measure(iterations, [&] {
+        size_t before = Resident();
+        gason2::vector<gason2::var_t, Allocator> storage;
+        for (size_t i = 0; i < slots; ++i)
+            storage.push_back(gason2::var_t{static_cast<double>(i)});
+        if (Resident() - before > resident)
+            resident = Resident() - before;
+    });
+    printf("%10.10s %8.2fms %8.1fMB %s\n", name, grow, resident / 1e6, filename);
+}
+
+int main(int argc, char **argv) {
+    int iterations = 10;
+    bool growth = false;
+    for (;;) {
+        if (argc > 2 && (!strcmp(argv[1], "-n") || !strcmp(argv[1], "--iterations"))) {
+            iterations = atoi(argv[2]);
+            argv += 2;
+            argc -= 2;
+        } else if (argc > 1 && (!strcmp(argv[1], "-g") || !strcmp(argv[1], "--growth"))) {
+            growth = true;
+            ++argv;
+            --argc;
+        } else {
+            break;
+        }
+    }
+
+    if (argc < 2 || iterations < 1) {
+        fprintf(stderr, "usage: %s [-n iterations] [-g] [file ...]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (growth)
+        printf("%10.10s %10.10s %10.10s\n", "vector", "grow", "resident");
+    else
+        printf("%10.10s %10.10s %10.10s %10.10s %10.10s %10.10s\n",
+               "layout",
+               "parse",
+               "MB/s",
+               "walk",
+               "stringify",
+               "ascii");
+
+    for (int i = 1; i < argc; ++i) {
+        FILE *fp = strcmp(argv[i], "-") ? fopen(argv[i], "rb") : stdin;
+        if (!fp) {
+            perror(argv[i]);
+            exit(EXIT_FAILURE);
+        }
+
+        gason2::vector<char> src;
+        while (!feof(fp)) {
+            char buf[BUFSIZ];
+            src.append(buf, fread(buf, 1, sizeof(buf), fp));
+        }
+        src.push_back('\0');
+        src.pop_back();
+        fclose(fp);
+
+        if (growth) {
+            gason2::document doc;
+            if (!doc.parse(src.data())) {
+                gason2::dump::print_error(argv[i], src.data(), doc);
+                continue;
+            }
+            size_t slots = Walk(doc);
+            Grow<gason2::heap_allocator>("heap", iterations, slots, argv[i]);
+            Grow<gason2::mapped_allocator<>>("mapped", iterations, slots, argv[i]);
+            continue;
+        }
+
+        for (const auto &layout : layouts) {
+            gason2::document doc;
+            bool ok = true;
+            double parse = Measure(iterations, [&] {
+                ok = doc.parse(src.data(), layout.options) && ok;
+                if (layout.compact)
+                    doc.compact();
+            });
+            if (!ok) {
+                gason2::dump::print_error(argv[i], src.data(), doc);
+                break;
+            }
+
+            size_t nodes = 0;
+            double walk = Measure(iterations, [&] { nodes += Walk(doc); });
+
+            gason2::vector<char> buffer;
+            double stringify = Measure(iterations, [&] {
+                buffer.resize(0);
+                gason2::dump::stringify(buffer, doc);
+            });
+            double ascii = Measure(iterations, [&] {
+                buffer.resize(0);
+                gason2::dump::write<gason2::ascii_format>(buffer, doc);
+            });
+
+            printf("%10.10s %8.2fms %10.1f %8.2fms %8.2fms %8.2fms %s\n",
+                   layout.name,
+                   parse,
+                   src.size() / parse / 1e3,
+                   walk,
+                   stringify,
+                   ascii,
+                   argv[i]);
+        }
+    }
+
+    return 0;
+}
@@ -33,14 +33,16 @@ int main(int argc, char **argv) {
 
         gason2::document doc;
         if (doc.parse(src.data())) {
-            gason2::vector<char> buffer;
+            gason2::writer<gason2::file_sink> out(gason2::file_sink{stdout});
             if (verbose)
-                gason2::dump::prettify(buffer, doc);
+                gason2::dump::prettify(out, doc);
             else
-                gason2::dump::stringify(buffer, doc);
-            buffer.push_back('\0');
-            buffer.pop_back();
-            printf("%s\n", buffer.begin());
+                gason2::dump::stringify(out, doc);
+            out.push_back('\n');
+            if (!out.flush()) {
+                perror("stdout");
+                exit(EXIT_FAILURE);
+            }
         } else {
             gason2::dump::print_error(argv[i], src.data(), doc);
         }
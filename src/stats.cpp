@@ -28,7 +28,7 @@ static void GenStat(Stat &stat, const gason2::value &v) {
 
     case gason2::type::object:
         for (auto i : v.members()) {
-            stat.stringLength += strlen(i.name().to_string());
+            stat.stringLength += i.name().string_length();
             GenStat(stat, i.value());
         }
         stat.memberCount += v.size() / 2;
@@ -38,7 +38,7 @@ static void GenStat(Stat &stat, const gason2::value &v) {
 
     case gason2::type::string:
         stat.stringCount++;
-        stat.stringLength += strlen(v.to_string());
+        stat.stringLength += v.string_length();
         break;
 
     case gason2::type::number:
@@ -64,7 +64,7 @@ int main(int argc, char **argv) {
         exit(EXIT_FAILURE);
     }
 
-    printf("%10.10s %10.10s %10.10s %10.10s %10.10s %10.10s %10.10s %10.10s %10.10s %10.10s\n",
+    printf("%10.10s %10.10s %10.10s %10.10s %10.10s %10.10s %10.10s %10.10s %10.10s %10.10s %10.10s %10.10s\n",
            "object",
            "array",
            "number",
@@ -74,7 +74,9 @@ int main(int argc, char **argv) {
            "null",
            "member",
            "element",
-           "#string");
+           "#string",
+           "bytes/byte",
+           "dedup");
 
     for (int i = 1; i < argc; ++i) {
         FILE *fp = strcmp(argv[i], "-") ? fopen(argv[i], "rb") : stdin;
@@ -96,7 +98,11 @@ int main(int argc, char **argv) {
         if (doc.parse(src.data())) {
             Stat stat = {};
             GenStat(stat, doc);
-            printf("%10zu %10zu %10zu %10zu %10zu %10zu %10zu %10zu %10zu %10zu %s\n",
+            doc.shrink_to_fit();
+            double bytes = double(doc.memory_usage().total()) / src.size();
+            doc.deduplicate();
+            doc.shrink_to_fit();
+            printf("%10zu %10zu %10zu %10zu %10zu %10zu %10zu %10zu %10zu %10zu %10.2f %10.2f %s\n",
                    stat.objectCount,
                    stat.arrayCount,
                    stat.numberCount,
@@ -107,6 +113,8 @@ int main(int argc, char **argv) {
                    stat.memberCount,
                    stat.elementCount,
                    stat.stringLength,
+                   bytes,
+                   double(doc.memory_usage().total()) / src.size(),
                    argv[i]);
         } else {
             gason2::dump::print_error(argv[i], src.data(), doc);
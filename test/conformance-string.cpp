@@ -6,7 +6,7 @@
     val = doc[0];                        \
     n = sizeof(expect) - 1;              \
     CHECK(val.to_string() == expect);    \
-    CHECK(strlen(val.to_string()) == n); \
+    CHECK(val.string_length() == n);     \
     CHECK_FALSE(memcmp(val.to_string(), expect, n))
 
 TEST_CASE("[nativejson-benchmark] conformance string") {
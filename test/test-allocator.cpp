@@ -0,0 +1,205 @@
+#include "doctest.h"
+#include "gason2.h"
+#include <string>
+#include <vector>
+
+TEST_CASE("[gason] mapped allocator") {
+    // a small threshold so that growth crosses it both ways
+    gason2::vector<size_t, gason2::mapped_allocator<4096>> v;
+    for (size_t i = 0; i < 100000; ++i)
+        v.push_back(i);
+    CHECK(v.size() == 100000);
+    bool same = true;
+    for (size_t i = 0; i < v.size(); ++i)
+        same = same && v[i] == i;
+    CHECK(same);
+
+    v.set_capacity(100);
+    CHECK(v.size() == 100);
+    CHECK(v.back() == 99);
+    v.set_capacity(1000000);
+    CHECK(v[50] == 50);
+
+    gason2::vector<size_t, gason2::mapped_allocator<4096>> w(static_cast<gason2::vector<size_t, gason2::mapped_allocator<4096>> &&>(v));
+    CHECK(v.empty());
+    CHECK(w.size() == 100);
+    v = static_cast<gason2::vector<size_t, gason2::mapped_allocator<4096>> &&>(w);
+    CHECK(v[99] == 99);
+}
+
+namespace {
+struct counting_resource : gason2::memory_resource {
+    size_t outstanding = 0;
+    size_t calls = 0;
+    size_t growths = 0; // blocks that were moved or extended to get bigger
+    size_t largest = 0;
+    size_t peak = 0;
+
+    void *reallocate(void *p, size_t old_size, size_t size) override {
+        ++calls;
+        growths += p && size > old_size;
+        largest = size > largest ? size : largest;
+        // realloc may move, so count the old block until it is gone
+        peak = outstanding + size > peak ? outstanding + size : peak;
+        outstanding += size - old_size;
+        return realloc(p, size);
+    }
+
+    void deallocate(void *p, size_t size) override {
+        outstanding -= size;
+        free(p);
+    }
+};
+} // namespace
+
+TEST_CASE("[gason] resource allocator") {
+    const char *json = u8R"json({"numbers": [1, 2, 3], "nested": {"name": "a string too long to inline", "list": [[], {}]}})json";
+    counting_resource resource;
+    {
+        gason2::basic_document<gason2::resource_allocator> doc(resource);
+        for (unsigned options : {0u, unsigned(gason2::separate_strings), unsigned(gason2::prescan), unsigned(gason2::segmented_storage)}) {
+            CHECK(doc.parse(json, options));
+            CHECK(doc["numbers"][2].to_int() == 3);
+            CHECK_EQ(doc["nested"]["name"].to_string(), "a string too long to inline");
+            doc.compact();
+            CHECK(doc["nested"]["list"].size() == 2);
+        }
+        CHECK_FALSE(doc.parse("[1, [2,]"));
+        CHECK(doc.error_code() == gason2::error::expecting_value);
+        CHECK(resource.calls > 0);
+    }
+    CHECK(resource.outstanding == 0);
+
+    gason2::key_pool keys;
+    {
+        gason2::basic_document<gason2::resource_allocator> doc(keys, resource);
+        CHECK(doc.parse(json));
+        CHECK(doc["nested"]["list"][1].size() == 0);
+    }
+    CHECK(resource.outstanding == 0);
+}
+
+TEST_CASE("[gason] monotonic arena") {
+    const char *json = u8R"json({"numbers": [1, 2, 3], "nested": {"name": "a string too long to inline", "list": [[], {}]}})json";
+    gason2::monotonic_arena arena(256);
+    size_t warm = 0;
+    for (int round = 0; round < 3; ++round) {
+        gason2::basic_document<gason2::monotonic_allocator> a(arena), b(arena);
+        CHECK(a.parse(json));
+        CHECK(b.parse(json, gason2::segmented_storage));
+        CHECK(a["numbers"][1].to_int() == 2);
+        CHECK_EQ(b["nested"]["name"].to_string(), "a string too long to inline");
+        if (round == 0)
+            warm = arena.capacity();
+        CHECK(arena.capacity() == warm);
+        arena.reset();
+    }
+
+    void *p = arena.allocate(16);
+    CHECK(arena.reallocate(p, 16, 64) == p);
+    arena.deallocate(p, 64);
+    CHECK(arena.allocate(8) == p);
+}
+
+TEST_CASE("[gason] arena pool") {
+    gason2::monotonic_arena *first;
+    {
+        auto lease = gason2::arena_pool::acquire();
+        first = &*lease;
+        gason2::basic_document<gason2::monotonic_allocator> doc(*lease);
+        CHECK(doc.parse("[1, [2, 3], \"pooled string\"]"));
+        CHECK(doc[1][1].to_int() == 3);
+    }
+    {
+        auto lease = gason2::arena_pool::acquire();
+        CHECK(&*lease == first);
+        auto other = gason2::arena_pool::acquire();
+        CHECK(&*other != first);
+    }
+}
+
+TEST_CASE("[gason] memory budget") {
+    // eight slots per number: the input expands well past its own size
+    gason2::vector<char> json;
+    json.push_back('[');
+    for (int i = 0; i < 1000; ++i)
+        json.append("1,", 2);
+    json.append("1]", 3);
+
+    alignas(8) static char buffer[4096];
+    for (unsigned options : {0u, unsigned(gason2::prescan), unsigned(gason2::segmented_storage)}) {
+        gason2::monotonic_arena budget(buffer, sizeof(buffer));
+        gason2::basic_document<gason2::monotonic_allocator> doc(budget);
+        CHECK_FALSE(doc.parse(json.data(), options));
+        CHECK(doc.error_code() == gason2::error::out_of_memory);
+        CHECK(doc.error_offset() < json.size());
+
+        budget.reset();
+        CHECK(doc.parse("[1, [2, 3], {\"key\": \"value\"}]", options & ~unsigned(gason2::segmented_storage)));
+        CHECK(doc[1][1].to_int() == 3);
+        CHECK(budget.capacity() < sizeof(buffer));
+    }
+
+    gason2::monotonic_arena none(buffer, 4);
+    gason2::basic_document<gason2::monotonic_allocator> doc(none);
+    CHECK_FALSE(doc.parse("[1]"));
+    CHECK(doc.error_code() == gason2::error::out_of_memory);
+}
+
+TEST_CASE("[gason] memory usage") {
+    // 1 + 3 array slots, 1 + 4 object slots, and a 10-byte string in 3 slots
+    const char *json = u8R"json([1, {"a": "0123456789", "b": 2}, 3])json";
+    for (unsigned options : {0u, unsigned(gason2::separate_strings), unsigned(gason2::prescan), unsigned(gason2::segmented_storage)}) {
+        gason2::document doc;
+        CHECK(doc.parse(json, options));
+        auto usage = doc.memory_usage();
+        CHECK(usage.slots == 9 * sizeof(gason2::var_t));
+        CHECK(usage.strings == ((options & (gason2::separate_strings | gason2::segmented_storage)) ? 19u : 24u));
+        CHECK(usage.total() == usage.slots + usage.strings + usage.slack);
+
+        doc.shrink_to_fit();
+        CHECK(doc.memory_usage().slots == usage.slots);
+        CHECK(doc.memory_usage().strings == usage.strings);
+        CHECK(doc.memory_usage().slack <= usage.slack);
+        CHECK_EQ(doc[1]["a"].to_string(), "0123456789");
+    }
+
+    gason2::document doc;
+    CHECK(doc.parse(json));
+    doc.shrink_to_fit();
+    CHECK(doc.memory_usage().slack == 0);
+}
+
+TEST_CASE("[gason] prescan reserves exactly") {
+    // the last string in storage is decoded into scratch slots past its end;
+    // one container each, so the prescan's own bookkeeping never grows
+    std::vector<std::string> docs = {"[1,2,\"xxxxxxxxxx\"]", "[\"" + std::string(100000, 'x') + "\"]"};
+    for (size_t n = 0; n < 100; ++n)
+        docs.push_back("[0, \"" + std::string(n, 'y') + "\\n\"]");
+    for (const std::string &json : docs) {
+        counting_resource resource;
+        gason2::basic_document<gason2::resource_allocator> doc(resource);
+        REQUIRE(doc.parse(json.c_str(), gason2::prescan));
+        CHECK(resource.growths == 0);
+    }
+}
+
+TEST_CASE("[gason] segmented storage never grows a block") {
+    // a flat array, as a table export would be
+    std::string json = "[0";
+    for (int i = 1; i < 500000; ++i)
+        json += ",1.5";
+    json += "]";
+
+    counting_resource resource;
+    {
+        gason2::basic_document<gason2::resource_allocator> doc(resource);
+        REQUIRE(doc.parse(json.c_str(), gason2::segmented_storage));
+        CHECK(doc.size() == 500000);
+        CHECK(doc[499999].to_number() == 1.5);
+        // nothing bigger than an arena chunk of 64 KiB and its header
+        CHECK(resource.largest <= 64 * 1024 + 64);
+        CHECK(resource.peak < doc.memory_usage().total() + 256 * 1024);
+    }
+    CHECK(resource.outstanding == 0);
+}
@@ -63,4 +63,16 @@ TEST_CASE("[gason] boxing errors") {
     TEST_ERROR(error::missing_colon);
     TEST_ERROR(error::missing_comma_or_bracket);
     TEST_ERROR(error::unexpected_character);
+    TEST_ERROR(error::out_of_memory);
+}
+
+TEST_CASE("[gason] boxing payload") {
+    size_t large = 0xFFFFFFFFFFFFull;
+    CHECK(var_t(type::array, 0xFFFFFFFFull + 1).payload() == 0xFFFFFFFFull + 1);
+    CHECK(var_t(type::object, large).payload() == large);
+    CHECK(var_t(type::object, large).type() == type::object);
+    CHECK(var_t(type::boolean, 1ull << 40).type() == type::boolean);
+    CHECK(var_t(error::unexpected_character).is_error());
+    CHECK_FALSE(var_t(type::null).is_error());
+    CHECK_FALSE(var_t(-NAN).is_error());
 }
@@ -0,0 +1,448 @@
+#include "doctest.h"
+#include "gason2.h"
+#include "gason2dump.h"
+#include <locale.h>
+#include <random>
+
+static std::string format(double x) {
+    char buf[32];
+    return std::string(buf, gason2::dtoa::format(buf, x));
+}
+
+TEST_CASE("[gason] number formatting") {
+    CHECK(format(0) == "0");
+    CHECK(format(-0.0) == "-0");
+    CHECK(format(1) == "1");
+    CHECK(format(-42) == "-42");
+    CHECK(format(9007199254740991) == "9007199254740991");
+    CHECK(format(0.1) == "0.1");
+    CHECK(format(-1.5) == "-1.5");
+    CHECK(format(0.000001234) == "0.000001234");
+    CHECK(format(1e21) == "1e21");
+    CHECK(format(1.5e300) == "1.5e300");
+    CHECK(format(5e-324) == "5e-324");
+    CHECK(format(1.7976931348623157e308) == "1.7976931348623157e308");
+    CHECK(format(2.2250738585072014e-308) == "2.2250738585072014e-308");
+    CHECK(format(123456789012345680) == "123456789012345680");
+    CHECK(format(0.30000000000000004) == "0.30000000000000004");
+}
+
+TEST_CASE("[gason] numbers ignore the locale") {
+    // numbers off the fast paths, which go to strtod
+    const char *json = "[1.5e300, 1.25e-30, 0.1234567890123456789012, -2.5e-310]";
+    const double expect[] = {1.5e300, 1.25e-30, 0.1234567890123456789012, -2.5e-310};
+    // where none of these locales is installed only the "C" check runs
+    bool tried = false;
+    for (const char *name : {"de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "ru_RU.UTF-8", "German"}) {
+        if (!setlocale(LC_NUMERIC, name))
+            continue;
+        tried = *localeconv()->decimal_point != '.';
+        gason2::document doc;
+        bool parsed = doc.parse(json);
+        bool same = parsed;
+        for (size_t i = 0; same && i < 4; ++i)
+            same = doc[i].to_number() == expect[i];
+        setlocale(LC_NUMERIC, "C");
+        CHECK(same);
+        if (tried)
+            break;
+    }
+    gason2::document doc;
+    REQUIRE(doc.parse(json));
+    CHECK(doc[0].to_number() == expect[0]);
+}
+
+TEST_CASE("[gason] number round trip") {
+    std::mt19937_64 random(42);
+    gason2::vector<double> values;
+    gason2::vector<char> json;
+    json.push_back('[');
+    size_t count = 0;
+    while (count < 100000) {
+        uint64_t bits = random();
+        double x;
+        memcpy(&x, &bits, sizeof(x));
+        if (!isfinite(x))
+            continue;
+        // every fourth a short decimal, as most real data has
+        if (count % 4 == 0)
+            x = static_cast<double>(static_cast<int64_t>(bits % 2000001) - 1000000) / 1000;
+        values.push_back(x);
+        char buf[32];
+        if (count++)
+            json.push_back(',');
+        json.append(buf, gason2::dtoa::format(buf, x) - buf);
+    }
+    json.append("]", 2);
+
+    gason2::document doc, again;
+    REQUIRE(doc.parse(json.data()));
+    gason2::vector<char> out;
+    gason2::dump::stringify(out, doc);
+    out.push_back('\0');
+    REQUIRE(again.parse(out.data()));
+    REQUIRE(again.size() == count);
+
+    size_t same = 0;
+    for (size_t i = 0; i < count; ++i) {
+        double a = doc[i].to_number(), b = again[i].to_number();
+        same += !memcmp(&a, &values[i], sizeof(a)) && !memcmp(&b, &values[i], sizeof(b));
+    }
+    CHECK(same == count);
+    CHECK(!strcmp(json.data(), out.data()));
+}
+
+static std::string stringify(const char *json) {
+    gason2::document doc;
+    REQUIRE(doc.parse(json));
+    gason2::vector<char> out;
+    gason2::dump::stringify(out, doc);
+    return std::string(out.begin(), out.end());
+}
+
+TEST_CASE("[gason] string escaping") {
+    CHECK(stringify(R"("plain")") == R"("plain")");
+    CHECK(stringify(R"("a\"b\\c\/d")") == R"("a\"b\\c/d")");
+    CHECK(stringify(R"("\b\f\n\r\t")") == R"("\b\f\n\r\t")");
+    CHECK(stringify(R"("\u0001\u001F\u0000x")") == R"("\u0001\u001f\u0000x")");
+    CHECK(stringify(u8R"("\u007F é 漢")") == u8"\"\x7F é 漢\"");
+
+    // escapes at every position around the 16-byte blocks
+    for (int i = 0; i < 40; ++i) {
+        for (const char *escape : {"\\\"", "\\\\", "\\n", "\\u0002"}) {
+            std::string body(i, 'x'), json = "\"" + body + escape + body + "\"";
+            std::string out = stringify(json.c_str());
+            CHECK(out == json);
+        }
+    }
+}
+
+TEST_CASE("[gason] verbatim strings") {
+    const char *json = u8R"json(["clean string", "with \"quote\"", "with \/ slash", "with A", "with \u001f", "short", "tab\tstop", {"clean key": 1, "escaped\nkey": 2}])json";
+    gason2::key_pool keys;
+    for (unsigned options : {0u, unsigned(gason2::separate_strings), unsigned(gason2::prescan), unsigned(gason2::segmented_storage)}) {
+        gason2::document doc, pooled(keys);
+        CHECK(doc.parse(json, options));
+        CHECK(doc[0].is_verbatim());
+        CHECK_FALSE(doc[1].is_verbatim());
+        CHECK(doc[2].is_verbatim());
+        CHECK(doc[3].is_verbatim());
+        CHECK_FALSE(doc[4].is_verbatim());
+        CHECK_FALSE(doc[5].is_verbatim());
+        CHECK_FALSE(doc[6].is_verbatim());
+        CHECK((*doc[7].members().begin()).name().is_verbatim());
+        CHECK_FALSE(doc[0][0].is_verbatim());
+
+        CHECK(pooled.parse(json, options));
+        auto member = pooled[7].members().begin();
+        CHECK((*member).name().is_verbatim());
+        CHECK_FALSE((*++member).name().is_verbatim());
+
+        doc.compact();
+        CHECK(doc[0].is_verbatim());
+        CHECK_FALSE(doc[1].is_verbatim());
+    }
+    CHECK(stringify(json) == R"(["clean string","with \"quote\"","with / slash","with A","with \u001f","short","tab\tstop",{"clean key":1,"escaped\nkey":2}])");
+}
+
+namespace {
+struct string_sink {
+    std::string *out;
+    bool operator()(const char *p, size_t n) const {
+        out->append(p, n);
+        return true;
+    }
+};
+} // namespace
+
+TEST_CASE("[gason] writer") {
+    const char *json = u8R"json({"name": "a long enough string to cross a small buffer", "list": [1, 2.5, true, null, "x\ty"], "nested": {"a": []}})json";
+    gason2::document doc;
+    REQUIRE(doc.parse(json));
+    gason2::vector<char> expect, pretty;
+    gason2::dump::stringify(expect, doc);
+    gason2::dump::prettify(pretty, doc);
+
+    std::string out;
+    {
+        gason2::writer<string_sink, 8> w(string_sink{&out});
+        gason2::dump::stringify(w, doc);
+        CHECK(w.size() == expect.size());
+    }
+    CHECK(out == std::string(expect.begin(), expect.end()));
+
+    out.clear();
+    gason2::writer<string_sink, 16> w(string_sink{&out});
+    gason2::dump::prettify(w, doc);
+    CHECK(w.flush());
+    CHECK(out == std::string(pretty.begin(), pretty.end()));
+
+    bool called = false;
+    auto failing = [&](const char *, size_t) { return called = true, false; };
+    gason2::writer<decltype(failing), 8> broken(failing);
+    gason2::dump::stringify(broken, doc);
+    CHECK(called);
+    CHECK_FALSE(broken.flush());
+
+    FILE *fp = tmpfile();
+    REQUIRE(fp);
+    {
+        gason2::writer<gason2::file_sink> f(gason2::file_sink{fp});
+        gason2::dump::stringify(f, doc);
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    {
+        fflush(fp);
+        gason2::writer<gason2::fd_sink> fd(gason2::fd_sink{fileno(fp)});
+        gason2::dump::stringify(fd, doc);
+    }
+    rewind(fp);
+    std::string twice = std::string(expect.begin(), expect.end()) + std::string(expect.begin(), expect.end());
+#else
+    rewind(fp);
+    std::string twice(expect.begin(), expect.end());
+#endif
+    std::string contents;
+    for (int c; (c = fgetc(fp)) != EOF;)
+        contents.push_back(static_cast<char>(c));
+    fclose(fp);
+    CHECK(contents == twice);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+TEST_CASE("[gason] gather") {
+    const char *json = u8R"json({"short": "abc", "long": "a verbatim string long enough to reference", "escaped": "line\nbreak", "list": [1, 2.5, "another string that is referenced"]})json";
+    gason2::document doc;
+    REQUIRE(doc.parse(json));
+    gason2::vector<char> expect;
+    gason2::dump::stringify(expect, doc);
+
+    gason2::gather g(16);
+    gason2::dump::stringify(g, doc);
+    REQUIRE(g.good());
+    CHECK(g.size() == expect.size());
+    CHECK(g.scratch_size() < expect.size() - 60);
+
+    const char *stored = doc["long"].to_string();
+    bool referenced = false;
+    std::string joined;
+    for (const iovec &i : g.iovecs()) {
+        referenced = referenced || i.iov_base == stored;
+        joined.append(static_cast<const char *>(i.iov_base), i.iov_len);
+    }
+    CHECK(referenced);
+    CHECK(joined == std::string(expect.begin(), expect.end()));
+
+    FILE *fp = tmpfile();
+    REQUIRE(fp);
+    CHECK(g.write(fileno(fp)));
+    rewind(fp);
+    std::string contents;
+    for (int c; (c = fgetc(fp)) != EOF;)
+        contents.push_back(static_cast<char>(c));
+    fclose(fp);
+    CHECK(contents == joined);
+
+    g.clear();
+    gason2::vector<char> pretty;
+    gason2::dump::prettify(pretty, doc);
+    gason2::dump::prettify(g, doc);
+    joined.clear();
+    for (const iovec &i : g.iovecs())
+        joined.append(static_cast<const char *>(i.iov_base), i.iov_len);
+    CHECK(joined == std::string(pretty.begin(), pretty.end()));
+}
+#endif
+
+TEST_CASE("[gason] measure") {
+    const char *docs[] = {
+        "0",
+        "\"\"",
+        "[]",
+        "{}",
+        "[[[[[[[[[[[[{\"deep\": 1}]]]]]]]]]]]]",
+        u8R"json({"a": [1, -2.5e-300, true, false, null], "b\n": "tab\there \u0001 é", "c": {"d": [[], {}]}})json",
+    };
+    for (const char *json : docs) {
+        gason2::document doc;
+        REQUIRE(doc.parse(json));
+        for (bool pretty : {false, true}) {
+            gason2::vector<char> expect;
+            if (pretty)
+                gason2::dump::prettify(expect, doc);
+            else
+                gason2::dump::stringify(expect, doc);
+
+            size_t n = gason2::dump::measure(doc, pretty);
+            CHECK(n == expect.size());
+            std::string out(n, '\0');
+            CHECK(gason2::dump::stringify_into(&out[0], n, doc, pretty) == n);
+            CHECK(out == std::string(expect.begin(), expect.end()));
+        }
+    }
+}
+
+TEST_CASE("[gason] serializer") {
+    const char *docs[] = {
+        "-1.5",
+        "\"abc\"",
+        "[]",
+        "{}",
+        u8R"json({"a": [1, -2.5e-300, true, false, null, [[]], {}], "b\n": "tab\there \u0001 é and a longer tail", "c": {"d": [[1, [2, [3]]], {"e": "\"\\"}]}})json",
+    };
+    for (const char *json : docs) {
+        gason2::document doc;
+        REQUIRE(doc.parse(json));
+        for (bool pretty : {false, true}) {
+            gason2::vector<char> expect;
+            if (pretty)
+                gason2::dump::prettify(expect, doc);
+            else
+                gason2::dump::stringify(expect, doc);
+
+            for (size_t chunk : {1, 2, 3, 7, 4096}) {
+                gason2::serializer s(doc, pretty);
+                std::string out;
+                char buffer[4096];
+                while (!s.done()) {
+                    size_t n = s.produce(buffer, chunk);
+                    out.append(buffer, n);
+                    if (n < chunk)
+                        break;
+                }
+                CHECK(s.done());
+                CHECK(s.good());
+                CHECK(out == std::string(expect.begin(), expect.end()));
+            }
+        }
+    }
+}
+
+namespace {
+// fails every third allocation
+struct flaky_resource : gason2::memory_resource {
+    std::atomic<size_t> calls{0}, failures{0};
+
+    void *reallocate(void *p, size_t, size_t size) override {
+        if (size && ++calls % 3 == 0)
+            return ++failures, nullptr;
+        return realloc(p, size);
+    }
+
+    void deallocate(void *p, size_t) override { free(p); }
+};
+} // namespace
+
+TEST_CASE("[gason] parallel") {
+    std::string json = "{\"small\": [1, {\"x\": []}], \"big\": [";
+    for (int i = 0; i < 5000; ++i)
+        json += (i ? ", " : "") + std::string(i % 3 ? "{\"k\": [1, \"a\\n\"]}" : "2.5");
+    json += "], \"wide\": {";
+    for (int i = 0; i < 3000; ++i)
+        json += (i ? ", \"" : "\"") + std::to_string(i) + "\": [" + std::to_string(i) + "]";
+    json += "}}";
+
+    gason2::document doc;
+    REQUIRE(doc.parse(json.c_str()));
+    gason2::vector<char> expect, pretty;
+    gason2::dump::stringify(expect, doc);
+    gason2::dump::prettify(pretty, doc);
+
+    for (unsigned threads : {1, 2, 3, 8}) {
+        gason2::vector<char> out;
+        gason2::dump::stringify_parallel(out, doc, threads);
+        CHECK(std::string(out.begin(), out.end()) == std::string(expect.begin(), expect.end()));
+        out.resize(0);
+        gason2::dump::prettify_parallel(out, doc, threads);
+        CHECK(std::string(out.begin(), out.end()) == std::string(pretty.begin(), pretty.end()));
+    }
+
+    // chunks whose buffers run out of memory are not lost
+    flaky_resource resource;
+    for (unsigned threads : {2, 8}) {
+        gason2::vector<char> out;
+        gason2::dump::stringify_parallel(out, doc, threads, gason2::resource_allocator(resource));
+        CHECK(std::string(out.begin(), out.end()) == std::string(expect.begin(), expect.end()));
+        out.resize(0);
+        gason2::dump::prettify_parallel(out, doc, threads, gason2::resource_allocator(resource));
+        CHECK(std::string(out.begin(), out.end()) == std::string(pretty.begin(), pretty.end()));
+    }
+    CHECK(resource.failures > 0);
+}
+
+namespace {
+struct tab_format : gason2::pretty_format {
+    static constexpr size_t indent_width = 1;
+    static constexpr char indent_char = '\t';
+};
+
+struct sorted_format : gason2::compact_format {
+    static constexpr bool sort_keys = true;
+};
+
+struct short_format : gason2::pretty_format {
+    static constexpr size_t indent_width = 2;
+    static char *number(char *buf, double x) { return buf + snprintf(buf, 32, "%.3g", x); }
+};
+
+template <typename Format>
+std::string write(const char *json) {
+    gason2::document doc;
+    REQUIRE(doc.parse(json));
+    gason2::vector<char> out;
+    gason2::dump::write<Format>(out, doc);
+    return std::string(out.begin(), out.end());
+}
+} // namespace
+
+TEST_CASE("[gason] formats") {
+    CHECK(write<tab_format>(R"({"a": [1, {}], "b": "c"})") == "{\n\t\"a\": [\n\t\t1,\n\t\t{}\n\t],\n\t\"b\": \"c\"\n}");
+    CHECK(write<short_format>("[3.14159, [2e-10]]") == "[\n  3.14,\n  [\n    2e-10\n  ]\n]");
+    CHECK(write<sorted_format>(R"({"b": 1, "a": {"z": 0, "y": 1}, "ab": 2, "": 3, "b": 4})") == R"({"":3,"a":{"y":1,"z":0},"ab":2,"b":1,"b":4})");
+    CHECK(write<gason2::ascii_format>(u8R"(["plain", "café é", "€", "😀", "\n\"\u0001"])") ==
+          R"(["plain","caf\u00e9 \u00e9","\u20ac","\ud83d\ude00","\n\"\u0001"])");
+    CHECK(write<gason2::compact_format>(u8R"({"é": ["x\ty", null, true]})") == u8R"({"é":["x\ty",null,true]})");
+
+    // sorting without memory gives the same order, equal names included
+    const char *json = R"({"b": 1, "a": {"z": 0, "y": 1}, "ab": 2, "": 3, "b": 4, "a": 5, "b": 6})";
+    gason2::document doc;
+    REQUIRE(doc.parse(json));
+    gason2::vector<char> out;
+    gason2::dump::write_sorted_in_place<sorted_format>(out, doc, 0);
+    out.push_back('}');
+    CHECK(std::string(out.begin(), out.end()) == write<sorted_format>(json));
+    CHECK(std::string(out.begin(), out.end()) == R"({"":3,"a":{"y":1,"z":0},"a":5,"ab":2,"b":1,"b":4,"b":6})");
+}
+
+TEST_CASE("[gason] ascii output of invalid UTF-8") {
+    gason2::vector<char> out;
+    gason2::dump::escape_ascii(out, gason2::string_view("a\x80" "b\xE2\x82" "c\xF8\xC3", 8));
+    CHECK(std::string(out.begin(), out.end()) == R"(a\ufffdb\ufffd\ufffdc\ufffd\ufffd)");
+
+    // overlong forms, surrogates and code points past U+10FFFF
+    const char *invalid[] = {"\xC0\xA2", "\xC1\xBF", "\xE0\x80\x80", "\xE0\x9F\xBF", "\xF0\x8F\xBF\xBF", "\xED\xA0\x80", "\xED\xBF\xBF", "\xF4\x90\x80\x80", "\xF5\x80\x80\x80"};
+    for (const char *bytes : invalid) {
+        out.resize(0);
+        gason2::dump::escape_ascii(out, bytes);
+        std::string expect;
+        for (size_t i = strlen(bytes); i--;)
+            expect += "\\ufffd";
+        CHECK(std::string(out.begin(), out.end()) == expect);
+    }
+
+    // and the valid code points right next to them stay
+    out.resize(0);
+    gason2::dump::escape_ascii(out, "\xC2\x80\xE0\xA0\x80\xED\x9F\xBF\xEE\x80\x80\xF0\x90\x80\x80\xF4\x8F\xBF\xBF");
+    CHECK(std::string(out.begin(), out.end()) == R"(\u0080\u0800\ud7ff\ue000\ud800\udc00\udbff\udfff)");
+}
+
+TEST_CASE("[gason] ascii output") {
+    // long enough for whole vector blocks, with escapes at every offset
+    std::string text = "0123456789abcdefghijklmnopqrstuvwxyz";
+    for (size_t i = 0; i <= text.size(); ++i) {
+        std::string input = text.substr(0, i) + "\xC3\xA9" + text.substr(i) + "\xF0\x9F\x98\x80\t";
+        gason2::vector<char> out;
+        gason2::dump::escape_ascii(out, gason2::string_view(input.data(), input.size()));
+        CHECK(std::string(out.begin(), out.end()) == text.substr(0, i) + "\\u00e9" + text.substr(i) + "\\ud83d\\ude00\\t");
+    }
+}
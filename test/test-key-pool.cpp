@@ -0,0 +1,99 @@
+#include "doctest.h"
+#include "gason2.h"
+#include "gason2dump.h"
+#include <string>
+#include <thread>
+
+TEST_CASE("[gason] key pool") {
+    gason2::key_pool pool;
+    gason2::document a(pool), b(pool);
+
+    CHECK(a.parse(u8R"json({"identifier": 1, "fullname": "first", "tags": {"identifier": "nested"}})json"));
+    CHECK(b.parse(u8R"json({"fullname": "second", "identifier": 2})json"));
+    CHECK(pool.size() == 2);
+
+    CHECK(a["identifier"].to_int() == 1);
+    CHECK(b["identifier"].to_int() == 2);
+    CHECK(a["tags"]["identifier"].string_length() == 6);
+    CHECK(b["fullname"].to_string_view().size() == 6);
+
+    auto id = pool.find("identifier");
+    CHECK(id.is_string());
+    CHECK(id.string_length() == 10);
+    CHECK(a[id].to_int() == 1);
+    CHECK(b[id].to_int() == 2);
+    CHECK(a[pool.find("tags")].is_object());
+    CHECK(pool.find("missing").is_null());
+
+    auto i = a.members().begin();
+    auto j = b.members().begin();
+    CHECK((*i).name().to_string() == (*++j).name().to_string());
+
+    gason2::vector<char> out;
+    gason2::dump::stringify(out, b);
+    CHECK(out.size() == 36);
+    CHECK_FALSE(memcmp(out.data(), u8R"json({"fullname":"second","identifier":2})json", out.size()));
+}
+
+TEST_CASE("[gason] key pool limit") {
+    gason2::key_pool pool(16, 1);
+    gason2::document doc(pool);
+
+    CHECK(doc.parse(u8R"json({"alpha": 1, "bravo": 2, "alpha": 3, "charlie": 4, "delta": 5})json"));
+    CHECK(pool.size() == 1);
+    CHECK(doc["alpha"].to_int() == 1);
+    CHECK(doc["charlie"].to_int() == 4);
+    CHECK(doc[pool.find("charlie")].to_int() == 4);
+    CHECK(doc[pool.find("delta")].to_int() == 5);
+
+    // names the full pool turned away are still found by their bytes
+    CHECK(doc.parse(u8R"json({"charlie": 1, "golfing": 2})json"));
+    CHECK(pool.find("golfing").is_null());
+    CHECK(doc["golfing"].to_int() == 2);
+    CHECK(doc[pool.find("golfing")].to_int() == 2);
+    CHECK(doc[pool.find("charlie")].to_int() == 1);
+    CHECK(doc.parse(u8R"json({"charlie": 1, "golfing": 2})json", gason2::separate_strings));
+    CHECK(doc[pool.find("golfing")].to_int() == 2);
+    CHECK(doc[pool.find("missing")].is_null());
+
+    // and so are names copied out of the pool's reach
+    gason2::document plain;
+    CHECK(plain.parse(u8R"json({"charlie": 1, "golfing": 2})json", gason2::separate_strings));
+    CHECK(plain[pool.find("charlie")].to_int() == 1);
+    CHECK(plain[pool.find("golfing")].to_int() == 2);
+}
+
+TEST_CASE("[gason] key pool rejects after a long string") {
+    gason2::key_pool pool(16, 0);
+    gason2::document doc(pool);
+    std::string json = "[\"abcdefgh\", \"" + std::string(131024, 'x') + "\", {\"keyname1\": 1, \"keyname2\": 2}]";
+
+    REQUIRE(doc.parse(json.c_str(), gason2::separate_strings));
+    CHECK(pool.size() == 0);
+    CHECK(doc[1].string_length() == 131024);
+    CHECK(doc[2]["keyname1"].to_int() == 1);
+    CHECK(doc[2]["keyname2"].to_int() == 2);
+}
+
+TEST_CASE("[gason] key pool concurrent") {
+    gason2::key_pool pool(64);
+    std::thread threads[4];
+    bool ok[4] = {};
+
+    for (int t = 0; t < 4; ++t)
+        threads[t] = std::thread([&pool, &ok, t] {
+            gason2::document doc(pool);
+            char json[64];
+            ok[t] = true;
+            for (int i = 0; i < 1000; ++i) {
+                snprintf(json, sizeof(json), "{\"key%04d\": %d, \"shared\": %d}", i % 100, i, t);
+                ok[t] = ok[t] && doc.parse(json) && doc["shared"].to_int() == t && doc.size() == 2;
+            }
+        });
+    for (auto &t : threads)
+        t.join();
+
+    for (bool i : ok)
+        CHECK(i);
+    CHECK(pool.size() == 101);
+}
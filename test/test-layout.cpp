@@ -0,0 +1,258 @@
+#include "doctest.h"
+#include "gason2.h"
+#include "gason2dump.h"
+#include <string>
+
+static const char *layout_json = u8R"json({
+    "empty": {},
+    "alpha": "abcdefghijklmnopqrstuvwyz",
+    "short": "ok",
+    "escapes": "\"\\\/\b\f\n\r\t € 𝄞",
+    "nul": "a\u0000b",
+    "num": 123456789,
+    "literals": [false, true, null],
+    "nested": [[], [{}], [{"a": [1, 2, 3], "bb": "longer value"}]]
+})json";
+
+static bool same_json(const gason2::value &a, const gason2::value &b) {
+    gason2::vector<char> x, y;
+    gason2::dump::stringify(x, a);
+    gason2::dump::stringify(y, b);
+    return x.size() == y.size() && !memcmp(x.data(), y.data(), x.size());
+}
+
+TEST_CASE("[gason] separate strings") {
+    gason2::document doc, expect;
+    CHECK(expect.parse(layout_json));
+    CHECK(doc.parse(layout_json, gason2::separate_strings));
+
+    CHECK(same_json(doc, expect));
+    CHECK_EQ(doc["alpha"].to_string(), "abcdefghijklmnopqrstuvwyz");
+    CHECK(doc["alpha"].string_length() == 25);
+    CHECK(doc["nul"].string_length() == 3);
+    CHECK(doc["nested"][2][0]["bb"].string_length() == 12);
+
+    gason2::vector<char> json;
+    json.append("[\"", 2);
+    for (int i = 0; i < 100000; ++i)
+        json.append("0123456789", 10);
+    json.append("\",\"tail\"]", 9);
+    json.push_back('\0');
+
+    CHECK(doc.parse(json.data(), gason2::separate_strings));
+    CHECK(doc[0].string_length() == 1000000);
+    CHECK_FALSE(memcmp(doc[0].to_string() + 999990, "0123456789", 11));
+    CHECK_EQ(doc[1].to_string(), "tail");
+
+    CHECK_FALSE(doc.parse(u8R"json(["unterminated)json", gason2::separate_strings));
+    CHECK(doc.error_code() == gason2::error::invalid_string_char);
+}
+
+// the string arena grows by unaligned amounts, which must not let aligned
+// allocations run past the end of a chunk
+TEST_CASE("[gason] arena stays in bounds") {
+    std::string json = "[\"abcdefgh\", \"" + std::string(131024, 'x') + "\"]";
+    gason2::document doc;
+    REQUIRE(doc.parse(json.c_str(), gason2::segmented_storage));
+    CHECK(doc.size() == 2);
+    CHECK(doc[1].string_length() == 131024);
+    CHECK(doc[1].to_string()[131023] == 'x');
+}
+
+TEST_CASE("[gason] prescan") {
+    gason2::document doc, expect;
+    CHECK(expect.parse(layout_json));
+    CHECK(doc.parse(layout_json, gason2::prescan));
+    CHECK(same_json(doc, expect));
+    CHECK(doc.parse(layout_json, gason2::prescan | gason2::separate_strings));
+    CHECK(same_json(doc, expect));
+    CHECK(doc["nested"][2][0]["a"].size() == 3);
+    CHECK(doc["nested"][2][0]["a"][2].to_int() == 3);
+
+    CHECK(doc.parse(u8R"json([",]{[\"", {"[": "]"}, [[[]]]])json", gason2::prescan));
+    CHECK(doc.size() == 3);
+    CHECK_EQ(doc[0].to_string(), ",]{[\"");
+    CHECK_EQ(doc[1]["["].to_string(), "]");
+    CHECK(doc[2][0][0].size() == 0);
+
+    for (int i = 0; i < 130; ++i) {
+        gason2::vector<char> json;
+        json.append("[\"", 2);
+        for (int j = 0; j < i; ++j)
+            json.push_back('a');
+        const char *tail = "\\\\\\\"]\\\\\", [1, {\"a\": [2, 3]}]]";
+        json.append(tail, strlen(tail) + 1);
+        CHECK(doc.parse(json.data(), gason2::prescan));
+        CHECK(doc.size() == 2);
+        CHECK(doc[0].string_length() == i + 4u);
+        CHECK(doc[1][1]["a"].size() == 2);
+    }
+
+    const char *invalid[] = {"[1 2]", "[1,]", "[,1]", "{\"a\" 1}", "{\"a\":1,}", "[[1],[2]", "{\"a\":[}", "[\"unterminated", "[1]]", "{\"a\":[}", "[{]"};
+    for (auto json : invalid) {
+        CHECK_FALSE(expect.parse(json));
+        CHECK_FALSE(doc.parse(json, gason2::prescan));
+        CHECK(doc.error_code() == expect.error_code());
+        CHECK(doc.error_offset() == expect.error_offset());
+    }
+}
+
+TEST_CASE("[gason] compact") {
+    gason2::document doc, expect;
+    CHECK(expect.parse(layout_json));
+    CHECK(doc.parse(layout_json));
+    doc.compact();
+    CHECK(same_json(doc, expect));
+    CHECK(doc["nested"][2][0]["a"][1].to_int() == 2);
+    CHECK(doc["nul"].string_length() == 3);
+
+    CHECK(doc.parse(u8R"json([[1, [2]], "long string value", [3]])json"));
+    doc.compact();
+    CHECK(doc[0][1][0].to_int() == 2);
+    CHECK(doc[2][0].to_int() == 3);
+    CHECK_EQ(doc[1].to_string(), "long string value");
+
+    CHECK_FALSE(doc.parse("[1,"));
+    doc.compact();
+    CHECK(doc.error_code() == gason2::error::expecting_value);
+}
+
+TEST_CASE("[gason] segmented storage") {
+    gason2::document doc, expect;
+    CHECK(expect.parse(layout_json));
+    CHECK(doc.parse(layout_json, gason2::segmented_storage));
+    CHECK(same_json(doc, expect));
+    CHECK(doc["nested"][2][0]["a"][1].to_int() == 2);
+    doc.compact();
+    CHECK(same_json(doc, expect));
+
+    // larger than a segment, and many small containers across segments
+    gason2::vector<char> json;
+    json.push_back('[');
+    for (int i = 0; i < 20000; ++i)
+        json.append("[1,\"segment\"],", 14);
+    json.append("0]", 3);
+    CHECK(doc.parse(json.data(), gason2::segmented_storage));
+    CHECK(doc.size() == 20001);
+    CHECK(doc[12345][0].to_int() == 1);
+    CHECK_EQ(doc[19999][1].to_string(), "segment");
+
+    gason2::key_pool keys(16, 1);
+    gason2::document pooled(keys);
+    CHECK(pooled.parse(u8R"json({"first key": 1, "second key": 2})json", gason2::segmented_storage));
+    CHECK(pooled["first key"].to_int() == 1);
+    CHECK(pooled["second key"].to_int() == 2);
+
+    CHECK_FALSE(doc.parse("[[1],[2]", gason2::segmented_storage));
+    CHECK(doc.error_code() == gason2::error::missing_comma_or_bracket);
+}
+
+TEST_CASE("[gason] segmented containers split into blocks") {
+    // sizes around whole blocks of 2040 slots, objects counting two a member
+    for (size_t n : {2039, 2040, 2041, 4080, 5000}) {
+        gason2::vector<char> json;
+        json.append("{\"numbers\": [", 13);
+        for (size_t i = 0; i < n; ++i) {
+            char buf[32];
+            json.append(buf, snprintf(buf, sizeof(buf), "%s%zu", i ? "," : "", i));
+        }
+        json.append("], \"object\": {", 14);
+        for (size_t i = 0; i < n / 2; ++i) {
+            char buf[64];
+            json.append(buf, snprintf(buf, sizeof(buf), "%s\"key %zu\": [%zu]", i ? "," : "", i, i));
+        }
+        json.append("}}", 3);
+
+        gason2::document doc, expect;
+        REQUIRE(expect.parse(json.data()));
+        REQUIRE(doc.parse(json.data(), gason2::segmented_storage));
+        CHECK(same_json(doc, expect));
+
+        gason2::value numbers = doc["numbers"];
+        CHECK(numbers.size() == n);
+        CHECK(numbers[n - 1].to_number() == double(n - 1));
+        CHECK(numbers[2040 % n].to_number() == double(2040 % n));
+        size_t count = 0;
+        bool ordered = true;
+        for (auto i : numbers.elements())
+            ordered = ordered && i.to_number() == double(count++);
+        CHECK(count == n);
+        CHECK(ordered);
+        CHECK((numbers.as_doubles() != nullptr) == (n <= 2040));
+        CHECK(doc["object"].size() == n / 2);
+        char last[32];
+        snprintf(last, sizeof(last), "key %zu", n / 2 - 1);
+        CHECK(doc["object"][last][0].to_int() == int(n / 2 - 1));
+
+        auto usage = doc.memory_usage();
+        CHECK(usage.slots == expect.memory_usage().slots);
+        CHECK(usage.total() == usage.slots + usage.strings + usage.slack);
+
+        gason2::document shared;
+        REQUIRE(shared.parse(json.data(), gason2::segmented_storage));
+        shared.deduplicate();
+        CHECK(same_json(shared, expect));
+        doc.compact();
+        CHECK(same_json(doc, expect));
+        CHECK(doc["numbers"].as_doubles() != nullptr);
+    }
+}
+
+TEST_CASE("[gason] deduplicate") {
+    const char *json = u8R"json([
+        {"street": "1 Infinite Loop", "city": "Cupertino", "tags": [], "extra": {}},
+        {"street": "1 Infinite Loop", "city": "Cupertino", "tags": [], "extra": {}},
+        {"street": "1 Infinite Loop", "city": "Cupertino", "tags": [1], "extra": {}},
+        [[], [], {}, "1 Infinite Loop"]
+    ])json";
+    for (unsigned options : {0u, unsigned(gason2::separate_strings), unsigned(gason2::prescan), unsigned(gason2::segmented_storage)}) {
+        gason2::document doc, expect;
+        CHECK(expect.parse(json, options));
+        CHECK(doc.parse(json, options));
+        auto before = doc.memory_usage();
+        size_t saved = doc.deduplicate();
+        CHECK(saved > 0);
+        CHECK(same_json(doc, expect));
+        auto after = doc.memory_usage();
+        CHECK(after.slots + after.strings + saved == before.slots + before.strings);
+        CHECK(doc.deduplicate() == 0);
+
+        CHECK(doc[0]["tags"].size() == 0);
+        CHECK(doc[2]["tags"][0].to_int() == 1);
+        CHECK_EQ(doc[3][3].to_string(), "1 Infinite Loop");
+        doc.compact();
+        CHECK(same_json(doc, expect));
+    }
+
+    gason2::document doc;
+    CHECK(doc.parse("\"a string on its own\""));
+    CHECK(doc.deduplicate() == 0);
+    CHECK_EQ(doc.to_string(), "a string on its own");
+}
+
+TEST_CASE("[gason] number arrays") {
+    const char *json = u8R"json({"coordinates": [[1.5, -2, 3e2], [4, 5, 6]], "mixed": [1, "two", 3], "empty": [], "object": {"a": 1}})json";
+    for (unsigned options : {0u, unsigned(gason2::separate_strings), unsigned(gason2::prescan), unsigned(gason2::segmented_storage)}) {
+        gason2::document doc, expect;
+        CHECK(expect.parse(json));
+        CHECK(doc.parse(json, options));
+        const double *p = doc["coordinates"][0].as_doubles();
+        REQUIRE(p != nullptr);
+        CHECK(p[0] == 1.5);
+        CHECK(p[1] == -2);
+        CHECK(p[2] == 300);
+        CHECK(doc["coordinates"][1].as_doubles()[2] == 6);
+        CHECK(doc["coordinates"].as_doubles() == nullptr);
+        CHECK(doc["mixed"].as_doubles() == nullptr);
+        CHECK(doc["empty"].as_doubles() != nullptr);
+        CHECK(doc["object"].as_doubles() == nullptr);
+        CHECK(doc["coordinates"][0][0].as_doubles() == nullptr);
+        CHECK(doc["coordinates"][1].size() == 3);
+        CHECK(same_json(doc, expect));
+
+        doc.deduplicate();
+        doc.compact();
+        CHECK(doc["coordinates"][1].as_doubles()[0] == 4);
+        CHECK(same_json(doc, expect));
+    }
+}
@@ -38,3 +38,40 @@ TEST_CASE("[gason] parsing") {
     CHECK(doc["literals"][999].is_null());
     CHECK(doc["literals"]["missing"].is_null());
 }
+
+TEST_CASE("[gason] string length") {
+    gason2::document doc;
+
+    CHECK(doc.parse(u8R"json({"": "", "nul": "a\u0000b", "long": "abcdefghijklmnopqrstuvwyz", "num": 1})json"));
+    CHECK(doc[""].string_length() == 0);
+    CHECK(doc[""].to_string_view().empty());
+    CHECK(doc["nul"].string_length() == 3);
+    CHECK(doc["nul"].to_string_view().size() == 3);
+    CHECK(doc["nul"].to_string_view()[2] == 'b');
+    CHECK(doc["long"].string_length() == 25);
+    CHECK(doc["num"].string_length() == 0);
+    CHECK(doc["num"].to_string_view("haha").size() == 4);
+    CHECK(doc["nu"].is_null());
+}
+
+TEST_CASE("[gason] short strings") {
+    gason2::document doc;
+
+    CHECK(doc.parse(u8R"json(["", "ok", "GET", "12345", "123456", "a\u0000b", "€"])json"));
+    CHECK(doc[0].is_string());
+    CHECK(doc[0].type() == gason2::type::string);
+    CHECK_EQ(doc[0].to_string(), "");
+    CHECK_EQ(doc[1].to_string(), "ok");
+    CHECK_EQ(doc[2].to_string(), "GET");
+    CHECK(doc[3].string_length() == 5);
+    CHECK_EQ(doc[3].to_string(), "12345");
+    CHECK(doc[4].string_length() == 6);
+    CHECK_EQ(doc[4].to_string(), "123456");
+    CHECK(doc[5].string_length() == 3);
+    CHECK(doc[6].string_length() == 3);
+
+    CHECK(doc.parse(u8R"json({"ok": true, "GET": "/"})json"));
+    CHECK(doc["ok"].to_bool());
+    CHECK_EQ(doc["GET"].to_string(), "/");
+    CHECK(doc["OK"].is_null());
+}